@@ -1,20 +1,36 @@
 #include "core/ecs/archetype.hpp"
 #include "ecs/archetype_chunk.hpp"
+#include <cstring>
+#include <limits>
 
 namespace violet
 {
 archetype::archetype(
     const std::vector<component_id>& components,
     const component_table& component_table,
-    archetype_chunk_allocator* allocator) noexcept
+    archetype_chunk_allocator* allocator,
+    const std::atomic<std::uint32_t>& change_version) noexcept
     : m_components(components),
       m_component_table(component_table),
       m_chunk_allocator(allocator),
-      m_size(0)
+      m_size(0),
+      m_change_version(change_version),
+      m_ordered_version(0)
 {
+    bool has_tag = false;
     for (component_id id : components)
+    {
         m_mask.set(id);
-    initialize_layout(components);
+
+        if (m_component_table[id]->has_storage())
+            m_columns.push_back(id);
+        else if (m_component_table[id]->is_tag())
+            has_tag = true;
+    }
+    initialize_layout(m_columns);
+
+    if (has_tag)
+        m_tag_storage.resize(m_entity_per_chunk);
 }
 
 archetype::~archetype()
@@ -24,93 +40,365 @@ archetype::~archetype()
 
 std::size_t archetype::add()
 {
-    std::size_t index = allocate();
+    std::size_t index = allocate(get_group({}), 1).first;
     construct(index);
 
     return index;
 }
 
-std::size_t archetype::move(std::size_t index, archetype& target)
+void archetype::add(std::span<actor* const> owners, std::span<std::size_t> indices)
 {
-    assert(this != &target);
+    assert(owners.size() == indices.size());
 
-    auto [source_chunk_index, source_entity_index] =
-        std::div(static_cast<const long>(index), static_cast<const long>(m_entity_per_chunk));
+    if (owners.empty())
+        return;
 
-    std::size_t target_index = target.allocate();
-    auto [target_chunk_index, target_entity_index] = std::div(
-        static_cast<const long>(target_index),
-        static_cast<const long>(target.m_entity_per_chunk));
+    std::size_t group = get_group({});
+    for (std::size_t i = 0; i < owners.size();)
+    {
+        auto [index, count] = allocate(group, owners.size() - i);
+        for (std::size_t j = 0; j < count; ++j)
+            indices[i + j] = index + j;
+        i += count;
+    }
 
-    for (component_id id : m_components)
+    for (component_id id : m_columns)
     {
-        if (target.m_mask.test(id))
+        auto& info = *m_component_table[id];
+
+        for (std::size_t i = 0; i < owners.size(); ++i)
         {
-            auto& info = *m_component_table[id];
-
-            std::size_t source_offset = m_offset[id] + source_entity_index * info.size();
-            std::size_t target_offset = target.m_offset[id] + target_entity_index * info.size();
-            info.move_construct(
-                iterator(this, index).get_component<actor*>(),
-                get_data_pointer(source_chunk_index, source_offset),
-                target.get_data_pointer(target_chunk_index, target_offset));
+            auto [chunk_index, entity_index] = std::div(
+                static_cast<const long>(indices[i]),
+                static_cast<const long>(m_entity_per_chunk));
+
+            std::size_t offset = m_offset[id] + entity_index * info.size();
+            info.construct(owners[i], get_data_pointer(chunk_index, offset));
         }
     }
 
-    for (component_id id : target.m_components)
+    for (std::size_t i = 0; i < owners.size(); ++i)
+        iterator(this, indices[i]).get_component<actor*>() = owners[i];
+}
+
+std::size_t archetype::move(std::size_t index, archetype& target)
+{
+    const shared_component_list& shared_components =
+        get_shared_components(index / m_entity_per_chunk);
+    if (shared_components.empty())
+        return move(index, target, shared_components);
+
+    shared_component_list target_shared_components;
+    for (auto& [id, value] : shared_components)
     {
-        if (!m_mask.test(id))
-        {
-            auto& info = *m_component_table[id];
+        if (target.m_mask.test(id))
+            target_shared_components.emplace_back(id, value);
+    }
+    return move(index, target, target_shared_components);
+}
 
-            std::size_t offset = target.m_offset[id] + target_entity_index * info.size();
-            info.construct(
-                iterator(this, index).get_component<actor*>(),
-                target.get_data_pointer(target_chunk_index, offset));
-        }
+std::size_t archetype::move(
+    std::size_t index,
+    archetype& target,
+    const shared_component_list& shared_components)
+{
+    assert(contains(index));
+
+    std::size_t group = target.get_group(shared_components);
+    assert(&target != this || group != m_chunk_groups[index / m_entity_per_chunk]);
+
+    std::size_t target_index = target.allocate(group, 1).first;
+    move_construct(target, index, target_index, 1);
+
+    for (component_id id : target.m_columns)
+    {
+        if (m_mask.test(id))
+            continue;
+
+        m_component_table[id]->construct(
+            *static_cast<actor**>(get_component(index, component_index::value<actor*>())),
+            target.get_component(target_index, id));
     }
 
     remove(index);
     return target_index;
 }
 
+void archetype::move(
+    std::size_t index,
+    std::size_t count,
+    archetype& target,
+    std::span<std::size_t> indices)
+{
+    assert(this != &target && indices.size() == count);
+    assert(count == 0 || (contains(index) && contains(index + count - 1) &&
+                          index / m_entity_per_chunk == (index + count - 1) / m_entity_per_chunk));
+
+    if (count == 0)
+        return;
+
+    shared_component_list shared_components;
+    for (auto& [id, value] : get_shared_components(index / m_entity_per_chunk))
+    {
+        if (target.m_mask.test(id))
+            shared_components.emplace_back(id, value);
+    }
+
+    std::size_t group = target.get_group(shared_components);
+    for (std::size_t i = 0; i < count;)
+    {
+        auto [target_index, run] = target.allocate(group, count - i);
+        move_construct(target, index + i, target_index, run);
+
+        for (std::size_t j = 0; j < run; ++j)
+            indices[i + j] = target_index + j;
+        i += run;
+    }
+
+    for (component_id id : target.m_columns)
+    {
+        if (m_mask.test(id))
+            continue;
+
+        auto& info = *m_component_table[id];
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            info.construct(
+                *static_cast<actor**>(get_component(index + i, component_index::value<actor*>())),
+                target.get_component(indices[i], id));
+        }
+    }
+
+    remove(index, count);
+}
+
 void archetype::remove(std::size_t index)
 {
-    assert(index < m_size);
+    remove(index, 1);
+}
+
+void archetype::remove(std::size_t index, std::size_t count)
+{
+    std::size_t chunk_index = index / m_entity_per_chunk;
+    std::size_t entity_index = index % m_entity_per_chunk;
+    assert(contains(index) && entity_index + count <= m_chunk_sizes[chunk_index]);
 
-    std::size_t back_index = m_size - 1;
-    if (back_index == index)
+    destruct(index, count);
+    m_size -= count;
+
+    // Fill the gap with the entities at the back of the group. Entities taken from other chunks
+    // fill the gap from its end, so the rest of the gap stays at the index.
+    std::size_t group = m_chunk_groups[chunk_index];
+    while (count != 0)
     {
-        destruct(index);
-        --m_size;
+        std::size_t back_chunk_index = m_groups[group].chunks.back();
+        std::size_t back_size = m_chunk_sizes[back_chunk_index];
+
+        std::size_t moved_count;
+        if (back_chunk_index == chunk_index)
+        {
+            std::size_t back_index = std::max(entity_index + count, back_size - count);
+            moved_count = back_size - back_index;
+            relocate(chunk_index * m_entity_per_chunk + back_index, index, moved_count);
+
+            back_size -= count;
+            count = 0;
+        }
+        else
+        {
+            moved_count = std::min(count, back_size);
+            relocate(
+                back_chunk_index * m_entity_per_chunk + back_size - moved_count,
+                index + count - moved_count,
+                moved_count);
+
+            back_size -= moved_count;
+            count -= moved_count;
+        }
+
+        m_chunk_sizes[back_chunk_index] = back_size;
+        if (moved_count != 0)
+            mark_changed(chunk_index);
+
+        if (back_size == 0)
+            m_chunk_allocator->free(detach_chunk(back_chunk_index));
     }
-    else
+}
+
+void archetype::merge(archetype& source, std::vector<std::size_t>& indices)
+{
+    assert(this != &source && m_mask == source.m_mask);
+
+    bool same_chunk_size =
+        m_chunk_allocator->get_chunk_size() == source.m_chunk_allocator->get_chunk_size();
+
+    for (std::size_t source_group = 0; source_group < source.m_groups.size(); ++source_group)
     {
-        destruct(index);
-        move_construct(back_index, index);
-        destruct(back_index);
-        --m_size;
+        if (source.m_groups[source_group].chunks.empty())
+            continue;
+
+        std::size_t group = get_group(source.m_groups[source_group].values);
+
+        // Copy whole chunks when the chunks differ in size, otherwise only fill the last chunk of
+        // the group from the back of the source.
+        std::size_t fill_count = std::numeric_limits<std::size_t>::max();
+        if (same_chunk_size)
+        {
+            const std::vector<std::size_t>& chunks = m_groups[group].chunks;
+            fill_count = chunks.empty() ? 0 : m_entity_per_chunk - m_chunk_sizes[chunks.back()];
+        }
+
+        while (fill_count != 0 && !source.m_groups[source_group].chunks.empty())
+        {
+            std::size_t chunk_index = source.m_groups[source_group].chunks.back();
+            std::size_t chunk_size = source.m_chunk_sizes[chunk_index];
+            std::size_t count = std::min(fill_count, chunk_size);
+
+            std::size_t first = indices.size();
+            indices.resize(first + count);
+            source.move(
+                chunk_index * source.m_entity_per_chunk + chunk_size - count,
+                count,
+                *this,
+                std::span<std::size_t>(indices).subspan(first));
+
+            fill_count -= count;
+        }
+
+        if (source.m_groups[source_group].chunks.empty())
+            continue;
+
+        // The remaining chunks start on a chunk boundary of the group and are taken over as they
+        // are, in the same order, so only the last one may be partially filled.
+        std::vector<std::size_t> source_chunks = source.m_groups[source_group].chunks;
+        std::vector<std::pair<archetype_chunk*, std::size_t>> chunks(source_chunks.size());
+        for (std::size_t i = source_chunks.size(); i-- > 0;)
+        {
+            std::size_t chunk_size = source.m_chunk_sizes[source_chunks[i]];
+            source.m_chunk_sizes[source_chunks[i]] = 0;
+            source.m_size -= chunk_size;
+
+            chunks[i] = {source.detach_chunk(source_chunks[i]), chunk_size};
+        }
+
+        m_chunk_allocator->adopt(*source.m_chunk_allocator, chunks.size());
+        for (auto [chunk, chunk_size] : chunks)
+        {
+            std::size_t chunk_index = attach_chunk(group, chunk);
+            m_chunk_sizes[chunk_index] = chunk_size;
+            m_size += chunk_size;
+            mark_changed(chunk_index);
+
+            for (std::size_t i = 0; i < chunk_size; ++i)
+                indices.push_back(chunk_index * m_entity_per_chunk + i);
+        }
     }
+}
 
-    if (m_size % m_entity_per_chunk == 0)
+void archetype::swap(std::size_t a, std::size_t b)
+{
+    assert(contains(a) && contains(b));
+    assert(m_chunk_groups[a / m_entity_per_chunk] == m_chunk_groups[b / m_entity_per_chunk]);
+
+    if (a == b)
+        return;
+
+    auto [a_chunk_index, a_entity_index] =
+        std::div(static_cast<const long>(a), static_cast<const long>(m_entity_per_chunk));
+    auto [b_chunk_index, b_entity_index] =
+        std::div(static_cast<const long>(b), static_cast<const long>(m_entity_per_chunk));
+
+    actor* a_owner = get_component_array<actor*>(a_chunk_index)[a_entity_index];
+    actor* b_owner = get_component_array<actor*>(b_chunk_index)[b_entity_index];
+
+    for (component_id id : m_columns)
     {
-        m_chunk_allocator->free(m_chunks.back());
-        m_chunks.pop_back();
+        auto& info = *m_component_table[id];
+
+        auto* a_data = static_cast<std::uint8_t*>(
+            get_data_pointer(a_chunk_index, m_offset[id] + a_entity_index * info.size()));
+        auto* b_data = static_cast<std::uint8_t*>(
+            get_data_pointer(b_chunk_index, m_offset[id] + b_entity_index * info.size()));
+
+        if (info.is_trivially_copyable())
+        {
+            std::swap_ranges(a_data, a_data + info.size(), b_data);
+        }
+        else
+        {
+            void* temp = m_swap_buffer.data();
+            std::size_t space = m_swap_buffer.size();
+            temp = std::align(info.align(), info.size(), temp, space);
+            assert(temp != nullptr);
+
+            info.move_construct(a_owner, a_data, temp);
+            info.destruct(a_data);
+            info.move_construct(b_owner, b_data, a_data);
+            info.destruct(b_data);
+            info.move_construct(a_owner, temp, b_data);
+            info.destruct(temp);
+        }
     }
+
+    mark_changed(a_chunk_index);
+    mark_changed(b_chunk_index);
 }
 
 void archetype::clear() noexcept
 {
-    for (std::size_t i = 0; i < m_size; ++i)
-        destruct(i);
+    for (std::size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        if (m_chunks[i] == nullptr)
+            continue;
 
-    for (archetype_chunk* chunk : m_chunks)
-        m_chunk_allocator->free(chunk);
+        destruct(i * m_entity_per_chunk, m_chunk_sizes[i]);
+        m_chunk_allocator->free(m_chunks[i]);
+    }
     m_chunks.clear();
+    m_chunk_sizes.clear();
+    m_chunk_groups.clear();
+    m_free_chunks.clear();
+    m_chunk_versions.clear();
+
+    for (std::size_t i = 0; i < m_groups.size(); ++i)
+    {
+        if (!m_groups[i].chunks.empty())
+            release_group(i);
+    }
+    m_groups.clear();
+    m_free_groups.clear();
 
     m_size = 0;
 }
 
+void archetype::mark_changed(std::size_t chunk_index) noexcept
+{
+    std::uint32_t version = m_change_version.load(std::memory_order_relaxed);
+
+    std::size_t begin = chunk_index * m_components.size();
+    for (std::size_t i = begin; i < begin + m_components.size(); ++i)
+    {
+        std::atomic_ref<std::uint32_t> chunk_version(m_chunk_versions[i]);
+        chunk_version.store(version, std::memory_order_relaxed);
+    }
+}
+
+void* archetype::get_component(std::size_t index, component_id component)
+{
+    assert(contains(index) && m_mask.test(component));
+
+    assert(!m_component_table[component]->is_shared());
+
+    auto [chunk_index, entity_index] =
+        std::div(static_cast<const long>(index), static_cast<const long>(m_entity_per_chunk));
+
+    if (m_component_table[component]->is_tag())
+        return m_tag_storage.data() + entity_index;
+
+    std::size_t offset = m_offset[component] + entity_index * m_component_table[component]->size();
+    return get_data_pointer(chunk_index, offset);
+}
+
 void archetype::initialize_layout(const std::vector<component_id>& components)
 {
     m_entity_per_chunk = 0;
@@ -141,27 +429,138 @@ void archetype::initialize_layout(const std::vector<component_id>& components)
         });
 
     std::size_t entity_size = 0;
+    std::size_t swap_buffer_size = 0;
     for (const auto& info : list)
+    {
         entity_size += info.size;
 
-    m_entity_per_chunk = archetype_chunk::CHUNK_SIZE / entity_size;
+        if (!m_component_table[info.id]->is_trivially_copyable())
+            swap_buffer_size = std::max(swap_buffer_size, info.size + info.align);
+    }
+    m_swap_buffer.resize(swap_buffer_size);
+
+    // An archetype of tags only still has a size, so give it as many entities as bytes.
+    m_entity_per_chunk =
+        m_chunk_allocator->get_chunk_size() / std::max(entity_size, static_cast<std::size_t>(1));
+    assert(m_entity_per_chunk != 0);
 
     std::size_t offset = 0;
     for (const auto& info : list)
     {
-        m_offset[info.id] = static_cast<std::uint16_t>(offset);
+        m_offset[info.id] = static_cast<std::uint32_t>(offset);
         offset += info.size * m_entity_per_chunk;
     }
 }
 
-std::size_t archetype::allocate()
+std::size_t archetype::get_group(const shared_component_list& shared_components)
 {
-    std::size_t index = m_size;
-    if (index >= capacity())
-        m_chunks.push_back(m_chunk_allocator->allocate());
+    auto iter = m_group_indices.find(shared_components);
+    if (iter != m_group_indices.end())
+        return iter->second;
 
-    ++m_size;
-    return index;
+    std::size_t group;
+    if (m_free_groups.empty())
+    {
+        group = m_groups.size();
+        m_groups.emplace_back();
+    }
+    else
+    {
+        group = m_free_groups.back();
+        m_free_groups.pop_back();
+    }
+
+    for (auto& [id, value] : shared_components)
+    {
+        assert(m_mask.test(id) && m_component_table[id]->is_shared());
+        m_component_table[id]->acquire_shared_value(value);
+    }
+
+    m_groups[group].values = shared_components;
+    m_group_indices[shared_components] = group;
+
+    return group;
+}
+
+void archetype::release_group(std::size_t group) noexcept
+{
+    chunk_group& info = m_groups[group];
+
+    for (auto& [id, value] : info.values)
+        m_component_table[id]->release_shared_value(value);
+
+    m_group_indices.erase(info.values);
+    info.values.clear();
+    info.chunks.clear();
+
+    m_free_groups.push_back(group);
+}
+
+std::pair<std::size_t, std::size_t> archetype::allocate(std::size_t group, std::size_t count)
+{
+    const std::vector<std::size_t>& chunks = m_groups[group].chunks;
+    if (chunks.empty() || m_chunk_sizes[chunks.back()] == m_entity_per_chunk)
+        attach_chunk(group, m_chunk_allocator->allocate());
+
+    std::size_t chunk_index = chunks.back();
+    std::size_t entity_index = m_chunk_sizes[chunk_index];
+    count = std::min(count, m_entity_per_chunk - entity_index);
+
+    m_chunk_sizes[chunk_index] += count;
+    m_size += count;
+    mark_changed(chunk_index);
+
+    return {chunk_index * m_entity_per_chunk + entity_index, count};
+}
+
+std::size_t archetype::attach_chunk(std::size_t group, archetype_chunk* chunk)
+{
+    std::size_t chunk_index;
+    if (m_free_chunks.empty())
+    {
+        chunk_index = m_chunks.size();
+        m_chunks.push_back(chunk);
+        m_chunk_sizes.push_back(0);
+        m_chunk_groups.push_back(group);
+        m_chunk_versions.resize(m_chunks.size() * m_components.size());
+    }
+    else
+    {
+        chunk_index = m_free_chunks.back();
+        m_free_chunks.pop_back();
+
+        m_chunks[chunk_index] = chunk;
+        m_chunk_groups[chunk_index] = group;
+    }
+
+    m_groups[group].chunks.push_back(chunk_index);
+    return chunk_index;
+}
+
+archetype_chunk* archetype::detach_chunk(std::size_t chunk_index) noexcept
+{
+    std::size_t group = m_chunk_groups[chunk_index];
+    assert(m_groups[group].chunks.back() == chunk_index && m_chunk_sizes[chunk_index] == 0);
+
+    m_groups[group].chunks.pop_back();
+    if (m_groups[group].chunks.empty())
+        release_group(group);
+
+    archetype_chunk* chunk = m_chunks[chunk_index];
+    m_chunks[chunk_index] = nullptr;
+    m_free_chunks.push_back(chunk_index);
+
+    // Slots at the back are dropped, so archetypes without shared components never have holes.
+    while (!m_chunks.empty() && m_chunks.back() == nullptr)
+    {
+        std::erase(m_free_chunks, m_chunks.size() - 1);
+        m_chunks.pop_back();
+        m_chunk_sizes.pop_back();
+        m_chunk_groups.pop_back();
+    }
+    m_chunk_versions.resize(m_chunks.size() * m_components.size());
+
+    return chunk;
 }
 
 void archetype::construct(std::size_t index)
@@ -169,55 +568,90 @@ void archetype::construct(std::size_t index)
     auto [chunk_index, entity_index] =
         std::div(static_cast<const long>(index), static_cast<const long>(m_entity_per_chunk));
 
-    for (component_id id : m_components)
+    actor* owner = get_component_array<actor*>(chunk_index)[entity_index];
+    for (component_id id : m_columns)
     {
         auto& info = *m_component_table[id];
 
         std::size_t offset = m_offset[id] + entity_index * info.size();
-        info.construct(
-            iterator(this, index).get_component<actor*>(),
-            get_data_pointer(chunk_index, offset));
+        info.construct(owner, get_data_pointer(chunk_index, offset));
     }
 }
 
-void archetype::move_construct(std::size_t source, std::size_t target)
+void archetype::destruct(std::size_t index, std::size_t count)
 {
-    auto [source_chunk_index, source_entity_index] =
-        std::div(static_cast<const long>(source), static_cast<const long>(m_entity_per_chunk));
-
-    auto [target_chunk_index, target_entity_index] =
-        std::div(static_cast<const long>(target), static_cast<const long>(m_entity_per_chunk));
+    auto [chunk_index, entity_index] =
+        std::div(static_cast<const long>(index), static_cast<const long>(m_entity_per_chunk));
 
-    for (component_id id : m_components)
+    for (component_id id : m_columns)
     {
         auto& info = *m_component_table[id];
+        if (info.is_trivially_destructible())
+            continue;
 
-        std::size_t source_offset = m_offset[id] + source_entity_index * info.size();
-        std::size_t target_offset = m_offset[id] + target_entity_index * info.size();
-
-        info.move_construct(
-            iterator(this, source).get_component<actor*>(),
-            get_data_pointer(source_chunk_index, source_offset),
-            get_data_pointer(target_chunk_index, target_offset));
+        auto* data = static_cast<std::uint8_t*>(
+            get_data_pointer(chunk_index, m_offset[id] + entity_index * info.size()));
+        for (std::size_t i = 0; i < count; ++i)
+            info.destruct(data + i * info.size());
     }
 }
 
-void archetype::destruct(std::size_t index)
+void archetype::move_construct(
+    archetype& target,
+    std::size_t source_index,
+    std::size_t target_index,
+    std::size_t count)
 {
-    auto [chunk_index, entity_index] =
-        std::div(static_cast<const long>(index), static_cast<const long>(m_entity_per_chunk));
+    auto [source_chunk_index, source_entity_index] = std::div(
+        static_cast<const long>(source_index),
+        static_cast<const long>(m_entity_per_chunk));
+    auto [target_chunk_index, target_entity_index] = std::div(
+        static_cast<const long>(target_index),
+        static_cast<const long>(target.m_entity_per_chunk));
 
-    for (component_id id : m_components)
+    actor** owners = get_component_array<actor*>(source_chunk_index);
+    for (component_id id : m_columns)
     {
+        if (!target.m_mask.test(id))
+            continue;
+
         auto& info = *m_component_table[id];
 
-        std::size_t offset = m_offset[id] + entity_index * info.size();
-        info.destruct(get_data_pointer(chunk_index, offset));
+        auto* source = static_cast<std::uint8_t*>(get_data_pointer(
+            source_chunk_index,
+            m_offset[id] + source_entity_index * info.size()));
+        auto* destination = static_cast<std::uint8_t*>(target.get_data_pointer(
+            target_chunk_index,
+            target.m_offset[id] + target_entity_index * info.size()));
+
+        if (info.is_trivially_copyable())
+        {
+            std::memcpy(destination, source, count * info.size());
+        }
+        else
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                info.move_construct(
+                    owners[source_entity_index + i],
+                    source + i * info.size(),
+                    destination + i * info.size());
+            }
+        }
     }
 }
 
+void archetype::relocate(std::size_t source_index, std::size_t target_index, std::size_t count)
+{
+    if (count == 0)
+        return;
+
+    move_construct(*this, source_index, target_index, count);
+    destruct(source_index, count);
+}
+
 void* archetype::get_data_pointer(std::size_t chunk_index, std::size_t offset)
 {
-    return &m_chunks[chunk_index]->data[offset];
+    return m_chunks[chunk_index]->get_data() + offset;
 }
 } // namespace violet
\ No newline at end of file
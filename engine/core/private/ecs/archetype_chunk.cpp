@@ -1,8 +1,26 @@
 #include "ecs/archetype_chunk.hpp"
+#include <algorithm>
 #include <cassert>
+#include <new>
 
 namespace violet
 {
+archetype_chunk_allocator::archetype_chunk_allocator(std::size_t chunk_size) noexcept
+    : m_chunk_size(chunk_size),
+      m_used_count(0),
+      m_peak_count(0)
+{
+    assert(chunk_size % alignof(archetype_chunk) == 0);
+}
+
+archetype_chunk_allocator::~archetype_chunk_allocator()
+{
+    assert(m_used_count == 0);
+
+    for (archetype_chunk* chunk : m_free)
+        ::operator delete(chunk, std::align_val_t(alignof(archetype_chunk)));
+}
+
 archetype_chunk* archetype_chunk_allocator::allocate()
 {
     archetype_chunk* result;
@@ -13,9 +31,13 @@ archetype_chunk* archetype_chunk_allocator::allocate()
     }
     else
     {
-        m_chunks.emplace_back(std::make_unique<archetype_chunk>());
-        result = m_chunks.back().get();
+        result = static_cast<archetype_chunk*>(
+            ::operator new(m_chunk_size, std::align_val_t(alignof(archetype_chunk))));
     }
+
+    ++m_used_count;
+    m_peak_count = std::max(m_peak_count, m_used_count);
+
     return result;
 }
 
@@ -23,5 +45,33 @@ void archetype_chunk_allocator::free(archetype_chunk* chunk)
 {
     assert(chunk != nullptr);
     m_free.push_back(chunk);
+    --m_used_count;
+}
+
+void archetype_chunk_allocator::adopt(archetype_chunk_allocator& source, std::size_t count)
+{
+    assert(source.m_chunk_size == m_chunk_size && source.m_used_count >= count);
+
+    source.m_used_count -= count;
+    m_used_count += count;
+    m_peak_count = std::max(m_peak_count, m_used_count);
+}
+
+std::size_t archetype_chunk_allocator::trim()
+{
+    std::size_t keep_count = m_peak_count - m_used_count;
+
+    std::size_t release_count = 0;
+    while (m_free.size() > keep_count)
+    {
+        ::operator delete(m_free.back(), std::align_val_t(alignof(archetype_chunk)));
+        m_free.pop_back();
+        ++release_count;
+    }
+    m_free.shrink_to_fit();
+
+    m_peak_count = m_used_count;
+
+    return release_count * m_chunk_size;
 }
-} // namespace violet
\ No newline at end of file
+} // namespace violet
@@ -1,25 +1,63 @@
 #pragma once
 
-#include <array>
-#include <memory>
+#include <cstdint>
 #include <vector>
 
 namespace violet
 {
+/**
+ * @brief A block of component data. The size of the block is decided by the allocator it comes
+ * from.
+ */
 struct alignas(64) archetype_chunk
 {
-    static constexpr std::size_t CHUNK_SIZE = 1024 * 16;
-    std::array<std::uint8_t, CHUNK_SIZE> data;
+    std::uint8_t* get_data() noexcept { return reinterpret_cast<std::uint8_t*>(this); }
 };
 
+/**
+ * @brief A pool of chunks of the same size.
+ *
+ * Freed chunks are kept for reuse. trim returns the free chunks that exceed the high water mark of
+ * the chunks used since the last trim, so memory needed for a recent peak stays in the pool while
+ * memory from older peaks is given back.
+ */
 class archetype_chunk_allocator
 {
 public:
+    archetype_chunk_allocator(std::size_t chunk_size) noexcept;
+    archetype_chunk_allocator(const archetype_chunk_allocator&) = delete;
+    ~archetype_chunk_allocator();
+
     archetype_chunk* allocate();
     void free(archetype_chunk* chunk);
 
+    /**
+     * @brief Take over used chunks of another allocator of the same size, for chunks that are
+     * moved between worlds. The chunks are freed to this allocator afterwards.
+     */
+    void adopt(archetype_chunk_allocator& source, std::size_t count);
+
+    /**
+     * @brief Release free chunks.
+     *
+     * @return std::size_t The number of released bytes.
+     */
+    std::size_t trim();
+
+    std::size_t get_chunk_size() const noexcept { return m_chunk_size; }
+
+    std::size_t get_used_count() const noexcept { return m_used_count; }
+    std::size_t get_reserved_count() const noexcept { return m_used_count + m_free.size(); }
+    std::size_t get_peak_count() const noexcept { return m_peak_count; }
+
+    archetype_chunk_allocator& operator=(const archetype_chunk_allocator&) = delete;
+
 private:
+    std::size_t m_chunk_size;
+
     std::vector<archetype_chunk*> m_free;
-    std::vector<std::unique_ptr<archetype_chunk>> m_chunks;
+
+    std::size_t m_used_count;
+    std::size_t m_peak_count;
 };
-} // namespace violet
\ No newline at end of file
+} // namespace violet
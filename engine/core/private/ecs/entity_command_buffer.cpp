@@ -0,0 +1,62 @@
+#include "core/ecs/entity_command_buffer.hpp"
+#include "core/ecs/world.hpp"
+#include <algorithm>
+
+namespace violet
+{
+entity_command_buffer::entity_command_buffer(world& world) noexcept : m_world(&world)
+{
+}
+
+entity_command_buffer::~entity_command_buffer()
+{
+    clear();
+}
+
+void entity_command_buffer::clear()
+{
+    for (component_value& value : m_values)
+        value.destruct(value.data);
+    m_values.clear();
+    m_commands.clear();
+
+    if (!m_pages.empty())
+    {
+        // Keep the first page for the next frame.
+        m_pages.resize(1);
+        m_page_begin = m_pages[0].get();
+        m_page_end = m_page_begin + PAGE_SIZE;
+    }
+}
+
+void* entity_command_buffer::allocate(std::size_t size, std::size_t align)
+{
+    std::size_t space = m_page_end - m_page_begin;
+    void* result = m_page_begin;
+    if (m_page_begin != nullptr && std::align(align, size, result, space))
+    {
+        m_page_begin = static_cast<std::uint8_t*>(result) + size;
+        return result;
+    }
+
+    std::size_t page_size = std::max(PAGE_SIZE, size + align);
+    m_pages.push_back(std::make_unique<std::uint8_t[]>(page_size));
+
+    space = page_size;
+    result = m_pages.back().get();
+    std::align(align, size, result, space);
+
+    if (page_size == PAGE_SIZE)
+    {
+        m_page_begin = static_cast<std::uint8_t*>(result) + size;
+        m_page_end = m_pages.back().get() + page_size;
+    }
+
+    return result;
+}
+
+entity entity_command_buffer::reserve_entity()
+{
+    return m_world->reserve_entity();
+}
+} // namespace violet
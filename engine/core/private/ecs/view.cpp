@@ -1,9 +1,36 @@
 #include "core/ecs/view.hpp"
+#include "common/log.hpp"
 #include "core/ecs/world.hpp"
+#include "core/task/task_executor.hpp"
 
 namespace violet
 {
-view_base::view_base(world& world) noexcept : m_world(&world)
+namespace
+{
+/**
+ * @brief Release the component access of a view when the view is done, also when the functor
+ * throws.
+ */
+class access_guard
+{
+public:
+    access_guard(world& world, const component_mask& read_mask, const component_mask& write_mask)
+        : m_world(world),
+          m_read_mask(read_mask),
+          m_write_mask(write_mask)
+    {
+    }
+
+    ~access_guard() { m_world.unlock_access(m_read_mask, m_write_mask); }
+
+private:
+    world& m_world;
+    const component_mask& m_read_mask;
+    const component_mask& m_write_mask;
+};
+} // namespace
+
+view_base::view_base(world& world) noexcept : m_world(&world), m_archetypes(nullptr)
 {
 }
 
@@ -11,26 +38,94 @@ view_base::~view_base()
 {
 }
 
-void view_base::set_mask(const component_mask& mask) noexcept
+void view_base::set_mask(
+    const component_mask& include_mask,
+    const component_mask& exclude_mask,
+    std::vector<component_mask> any_masks)
 {
-    m_mask = mask;
-    m_version = -1;
+    m_include_mask = include_mask;
+    m_exclude_mask = exclude_mask;
+    m_any_masks = std::move(any_masks);
+    m_archetypes = &m_world->get_archetypes(include_mask, exclude_mask);
 }
 
-const std::vector<archetype*>& view_base::sync_archetype_list()
+void view_base::set_access(
+    const component_mask& read_mask,
+    const component_mask& write_mask) noexcept
 {
-    if (m_version != m_world->m_view_version)
+    m_read_mask = read_mask;
+    m_write_mask = write_mask;
+}
+
+std::uint32_t view_base::advance_change_version() noexcept
+{
+    return m_world->advance_change_version();
+}
+
+void view_base::parallel_chunk(
+    task_executor& executor,
+    const std::function<void(archetype*, std::size_t)>& functor)
+{
+    std::vector<std::pair<archetype*, std::size_t>> chunks;
+    for (archetype* archetype : get_archetypes())
     {
-        m_archetypes.clear();
-        for (auto& [mask, archetype] : m_world->m_archetypes)
+        if (!is_match(archetype))
+            continue;
+
+        for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
         {
-            if ((m_mask & archetype->get_mask()) == m_mask)
-                m_archetypes.push_back(archetype.get());
+            if (archetype->get_chunk_size(i) != 0)
+                chunks.push_back({archetype, i});
         }
+    }
+
+    if (chunks.empty())
+        return;
+
+    // Running views with conflicting access at the same time is a bug of the caller. Waiting for
+    // the other view could deadlock, when it needs the calling worker to finish.
+    if (!m_world->try_lock_access(m_read_mask, m_write_mask))
+    {
+        log::error("Conflicting component access, the parallel view is not run.");
+        return;
+    }
+    access_guard guard(*m_world, m_read_mask, m_write_mask);
+
+    std::atomic<std::size_t> next_chunk = 0;
+    auto process = [&]()
+    {
+        for (std::size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+            functor(chunks[i].first, chunks[i].second);
+    };
 
-        m_version = m_world->m_view_version;
+    // The calling thread takes part in processing, so only the remaining chunks are handed to the
+    // worker threads.
+    std::size_t worker_count = std::min(chunks.size() - 1, executor.get_thread_count());
+    if (worker_count == 0)
+    {
+        process();
+        return;
+    }
+
+    task_graph<> graph;
+    for (std::size_t i = 0; i < worker_count; ++i)
+        graph.get_root().then(process);
+
+    task_future future = executor.execute(graph);
+    try
+    {
+        process();
+    }
+    catch (...)
+    {
+        // The tasks reference the graph and the chunks on this stack, so they have to finish
+        // before unwinding. Skip the chunks they have not started.
+        next_chunk = chunks.size();
+        executor.wait(future);
+        throw;
     }
 
-    return m_archetypes;
+    // Help with the remaining tasks, the root may still be in the queue of this thread.
+    executor.wait(future);
 }
-} // namespace violet
\ No newline at end of file
+} // namespace violet
@@ -1,47 +1,98 @@
 #include "core/ecs/world.hpp"
+#include "core/ecs/actor.hpp"
 #include "ecs/archetype_chunk.hpp"
+#include <algorithm>
 
 namespace violet
 {
-world::world() : m_view_version(0)
+world::world(std::size_t chunk_size) : world(std::make_shared<component_table>(), chunk_size)
 {
-    m_archetype_chunk_allocator = std::make_unique<archetype_chunk_allocator>();
+}
 
-    register_component<actor*>();
-    register_component<entity_record>();
+world::world(std::shared_ptr<component_table> component_table, std::size_t chunk_size)
+    : m_entity_count(0),
+      m_free_entity(INVALID_ENTITY_INDEX),
+      m_change_version(1),
+      m_component_registry(std::move(component_table)),
+      m_component_table(*m_component_registry),
+      m_chunk_size(chunk_size)
+{
+    if (!is_component_register<actor*>())
+        register_component<actor*>();
+    if (!is_component_register<entity_record>())
+        register_component<entity_record>();
 }
 
 world::~world()
 {
     for (auto& [_, archetype] : m_archetypes)
         archetype->clear();
+
+    for (auto& page : m_entity_pages)
+        delete[] page.load();
 }
 
 entity world::create(actor* owner)
+{
+    entity result = reserve_entity();
+    create(result, owner);
+    return result;
+}
+
+entity world::reserve_entity()
 {
     entity result;
-    if (m_free_entity.empty())
+
+    std::uint64_t head = m_free_entity.load(std::memory_order_acquire);
+    while (static_cast<std::uint32_t>(head) != INVALID_ENTITY_INDEX)
     {
-        result.index = m_entity_infos.size();
-        m_entity_infos.emplace_back();
+        auto index = static_cast<std::uint32_t>(head);
+        std::uint64_t tag = (head >> 32) + 1;
+        std::uint64_t next = get_entity_info(index).next_free.load(std::memory_order_relaxed);
+
+        if (m_free_entity.compare_exchange_weak(
+                head,
+                (tag << 32) | next,
+                std::memory_order_acquire,
+                std::memory_order_acquire))
+        {
+            result.index = index;
+            result.entity_version = get_entity_info(index).entity_version;
+            return result;
+        }
     }
-    else
+
+    result.index = m_entity_count.fetch_add(1, std::memory_order_relaxed);
+
+    std::size_t page_index = result.index / ENTITY_PAGE_SIZE;
+    assert(page_index < MAX_ENTITY_PAGE);
+
+    if (m_entity_pages[page_index].load(std::memory_order_acquire) == nullptr)
     {
-        result.index = m_free_entity.front();
-        m_free_entity.pop();
-        result.entity_version = m_entity_infos[result.index].entity_version;
+        entity_info* page = new entity_info[ENTITY_PAGE_SIZE];
+        entity_info* expected = nullptr;
+        if (!m_entity_pages[page_index].compare_exchange_strong(
+                expected,
+                page,
+                std::memory_order_acq_rel))
+            delete[] page;
     }
 
-    add_component<actor*, entity_record>(result);
-    get_component<actor*>(result) = owner;
-    get_component<entity_record>(result).entity_index = result.index;
-
     return result;
 }
 
+void world::create(entity entity, actor* owner)
+{
+    assert(is_valid(entity).first && get_entity_info(entity.index).archetype == nullptr);
+
+    add_component<actor*, entity_record>(entity);
+    get_component<actor*>(entity) = owner;
+    get_component<entity_record>(entity).entity_index = entity.index;
+}
+
 void world::release(entity entity)
 {
-    entity_info& info = m_entity_infos[entity.index];
+    entity_info& info = get_entity_info(entity.index);
     if (info.archetype != nullptr)
     {
         info.archetype->remove(info.archetype_index);
@@ -52,23 +103,351 @@ void world::release(entity entity)
     info.archetype_index = 0;
     ++info.entity_version;
 
-    m_free_entity.push(entity.index);
+    push_free_entity(entity.index);
+}
+
+void world::release_batch(std::span<const entity> entities)
+{
+    // Remove from the back of each archetype first, so that fewer entities need to be swapped into
+    // the released slots.
+    std::vector<entity> sorted(entities.begin(), entities.end());
+    std::sort(
+        sorted.begin(),
+        sorted.end(),
+        [this](const entity& a, const entity& b)
+        {
+            const entity_info& a_info = get_entity_info(a.index);
+            const entity_info& b_info = get_entity_info(b.index);
+            return a_info.archetype == b_info.archetype
+                       ? a_info.archetype_index > b_info.archetype_index
+                       : a_info.archetype < b_info.archetype;
+        });
+
+    // Consecutive entities of a chunk are removed together.
+    for (std::size_t begin = 0, end = 0; begin < sorted.size(); begin = end)
+    {
+        entity_info& info = get_entity_info(sorted[begin].index);
+
+        end = begin + 1;
+        while (end < sorted.size() && info.archetype != nullptr)
+        {
+            const entity_info& next_info = get_entity_info(sorted[end].index);
+            if (next_info.archetype != info.archetype ||
+                next_info.archetype_index + (end - begin) != info.archetype_index ||
+                next_info.archetype_index / info.archetype->entity_per_chunk() !=
+                    info.archetype_index / info.archetype->entity_per_chunk())
+                break;
+            ++end;
+        }
+
+        if (info.archetype != nullptr)
+        {
+            archetype* archetype = info.archetype;
+            std::size_t index = get_entity_info(sorted[end - 1].index).archetype_index;
+            std::size_t count = end - begin;
+
+            archetype->remove(index, count);
+
+            // Entities that filled the gap are moved into the removed range.
+            for (std::size_t i = index; i < index + count; ++i)
+            {
+                if (!archetype->contains(i))
+                    break;
+
+                auto iter = archetype->begin() + i;
+                entity_info& moved_info =
+                    get_entity_info(iter.get_component<entity_record>().entity_index);
+                moved_info.archetype_index = i;
+                ++moved_info.component_version;
+            }
+        }
+
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            entity_info& released_info = get_entity_info(sorted[i].index);
+            released_info.archetype = nullptr;
+            released_info.archetype_index = 0;
+            ++released_info.component_version;
+            ++released_info.entity_version;
+
+            push_free_entity(sorted[i].index);
+        }
+    }
+}
+
+entity_command_buffer& world::get_command_buffer()
+{
+    std::lock_guard<std::mutex> lock(m_command_buffer_lock);
+
+    auto& buffer = m_command_buffers[std::this_thread::get_id()];
+    if (buffer == nullptr)
+        buffer = std::make_unique<entity_command_buffer>(*this);
+    return *buffer;
+}
+
+void world::playback()
+{
+    std::vector<entity_command_buffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(m_command_buffer_lock);
+        for (auto& [thread_id, buffer] : m_command_buffers)
+        {
+            if (!buffer->empty())
+                buffers.push_back(buffer.get());
+        }
+    }
+
+    playback(buffers);
+}
+
+void world::playback(std::span<entity_command_buffer* const> buffers)
+{
+    using command_type = entity_command_buffer::command;
+
+    struct pending_command
+    {
+        entity_command_buffer* buffer;
+        const command_type* command;
+
+        void assign(archetype* archetype, std::size_t index) const
+        {
+            for (std::size_t i = 0; i < command->value_count; ++i)
+            {
+                auto& value = buffer->m_values[command->value_offset + i];
+                if (archetype->get_mask().test(value.id))
+                    value.assign(archetype->get_component(index, value.id), value.data);
+            }
+        }
+    };
+
+    std::unordered_map<component_mask, std::vector<pending_command>> creates;
+    std::vector<pending_command> changes;
+    for (entity_command_buffer* buffer : buffers)
+    {
+        for (const command_type& command : buffer->m_commands)
+        {
+            if (command.type == ENTITY_COMMAND_TYPE_CREATE)
+                creates[command.mask].push_back({buffer, &command});
+            else
+                changes.push_back({buffer, &command});
+        }
+    }
+
+    // Entities with the same components are created in one batch.
+    std::vector<actor*> owners;
+    std::vector<entity> entities;
+    for (auto& [mask, commands] : creates)
+    {
+        owners.clear();
+        entities.clear();
+        for (const pending_command& command : commands)
+        {
+            owners.push_back(command.command->owner);
+            entities.push_back(command.command->target);
+        }
+
+        component_mask archetype_mask = mask;
+        archetype_mask.set(component_index::value<actor*>());
+        archetype_mask.set(component_index::value<entity_record>());
+        archetype* archetype = get_or_create_archetype(archetype_mask);
+
+        place_batch(archetype, owners, entities);
+        for (std::size_t i = 0; i < entities.size(); ++i)
+            commands[i].assign(archetype, get_entity_info(entities[i].index).archetype_index);
+    }
+
+    // Fold all commands of an entity into its final component mask, keeping the recording order of
+    // each entity.
+    std::stable_sort(
+        changes.begin(),
+        changes.end(),
+        [](const pending_command& a, const pending_command& b)
+        {
+            return a.command->target.index < b.command->target.index;
+        });
+
+    struct entity_move
+    {
+        std::uint32_t entity_index;
+        archetype* target;
+
+        std::size_t command_begin;
+        std::size_t command_end;
+    };
+    std::vector<entity_move> moves;
+    std::vector<entity> releases;
+
+    for (std::size_t begin = 0, end = 0; begin < changes.size(); begin = end)
+    {
+        entity target = changes[begin].command->target;
+        while (end < changes.size() && changes[end].command->target.index == target.index)
+            ++end;
+
+        if (!is_valid(target).first)
+            continue;
+
+        entity_info& info = get_entity_info(target.index);
+        component_mask mask;
+        if (info.archetype != nullptr)
+            mask = info.archetype->get_mask();
+
+        bool released = false;
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            const command_type& command = *changes[i].command;
+            if (command.type == ENTITY_COMMAND_TYPE_RELEASE)
+                released = true;
+            else if (command.type == ENTITY_COMMAND_TYPE_ADD)
+                mask |= command.mask;
+            else if (command.type == ENTITY_COMMAND_TYPE_REMOVE)
+                mask &= ~command.mask;
+        }
+
+        if (released)
+        {
+            releases.push_back(target);
+        }
+        else if (info.archetype != nullptr && info.archetype->get_mask() == mask)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                changes[i].assign(info.archetype, info.archetype_index);
+        }
+        else
+        {
+            archetype* archetype = mask.none() ? nullptr : get_or_create_archetype(mask);
+            moves.push_back({target.index, archetype, begin, end});
+        }
+    }
+
+    std::sort(
+        moves.begin(),
+        moves.end(),
+        [](const entity_move& a, const entity_move& b)
+        {
+            return a.target < b.target;
+        });
+
+    for (const entity_move& move : moves)
+    {
+        entity_info& info = get_entity_info(move.entity_index);
+
+        if (move.target == nullptr)
+        {
+            info.archetype->remove(info.archetype_index);
+            on_entity_move(move.entity_index, nullptr, 0);
+            continue;
+        }
+
+        std::size_t new_archetype_index = 0;
+        if (info.archetype != nullptr)
+            new_archetype_index = info.archetype->move(info.archetype_index, *move.target);
+        else
+            new_archetype_index = move.target->add();
+        on_entity_move(move.entity_index, move.target, new_archetype_index);
+
+        for (std::size_t i = move.command_begin; i < move.command_end; ++i)
+            changes[i].assign(move.target, new_archetype_index);
+    }
+
+    release_batch(releases);
+
+    for (entity_command_buffer* buffer : buffers)
+        buffer->clear();
+}
+
+std::vector<entity> world::merge(world& other)
+{
+    assert(this != &other && m_component_registry == other.m_component_registry);
+
+    std::vector<entity> result(other.m_entity_count.load(std::memory_order_relaxed));
+
+    std::vector<std::size_t> indices;
+    for (auto& [mask, source] : other.m_archetypes)
+    {
+        if (source->size() == 0)
+            continue;
+
+        archetype* target = get_or_create_archetype(mask);
+
+        indices.clear();
+        target->merge(*source, indices);
+
+        for (std::size_t i : indices)
+        {
+            auto iter = target->begin() + i;
+            auto& record = iter.get_component<entity_record>();
+
+            entity_info& old_info = other.get_entity_info(
+                static_cast<std::uint32_t>(record.entity_index));
+            old_info.archetype = nullptr;
+            old_info.archetype_index = 0;
+            ++old_info.entity_version;
+            other.push_free_entity(static_cast<std::uint32_t>(record.entity_index));
+
+            entity new_entity = reserve_entity();
+            entity_info& info = get_entity_info(new_entity.index);
+            info.archetype = target;
+            info.archetype_index = i;
+            new_entity.component_version = ++info.component_version;
+
+            result[record.entity_index] = new_entity;
+            record.entity_index = new_entity.index;
+
+            if (actor* owner = iter.get_component<actor*>())
+            {
+                owner->m_world = this;
+                owner->m_entity = new_entity;
+            }
+        }
+    }
+
+    return result;
 }
 
 std::pair<bool, bool> world::is_valid(entity entity) const
 {
-    if (entity.index < m_entity_infos.size())
+    const entity_info* info = find_entity_info(entity.index);
+    if (info != nullptr)
         return {
-            m_entity_infos[entity.index].entity_version == entity.entity_version,
-            m_entity_infos[entity.index].component_version == entity.component_version};
+            info->entity_version == entity.entity_version,
+            info->component_version == entity.component_version};
     else
         return {false, false};
 }
 
 std::pair<std::uint16_t, std::uint16_t> world::get_version(entity entity) const
 {
-    const entity_info& info = m_entity_infos[entity.index];
-    return {info.entity_version, info.component_version};
+    const entity_info* info = find_entity_info(entity.index);
+    if (info != nullptr)
+        return {info->entity_version, info->component_version};
+    else
+        return {0, 0};
+}
+
+bool world::try_lock_access(const component_mask& read_mask, const component_mask& write_mask)
+{
+    std::lock_guard<std::mutex> lock(m_access_lock);
+    for (const component_access& access : m_accesses)
+    {
+        if ((write_mask & (access.read_mask | access.write_mask)).any() ||
+            (read_mask & access.write_mask).any())
+            return false;
+    }
+    m_accesses.push_back(component_access{read_mask, write_mask});
+    return true;
+}
+
+void world::unlock_access(const component_mask& read_mask, const component_mask& write_mask)
+{
+    std::lock_guard<std::mutex> lock(m_access_lock);
+    for (auto iter = m_accesses.begin(); iter != m_accesses.end(); ++iter)
+    {
+        if (iter->read_mask == read_mask && iter->write_mask == write_mask)
+        {
+            m_accesses.erase(iter);
+            break;
+        }
+    }
 }
 
 void world::on_entity_move(
@@ -76,26 +455,295 @@ void world::on_entity_move(
     archetype* new_archetype,
     std::size_t new_archetype_index)
 {
-    entity_info& info = m_entity_infos[entity_index];
-    if (info.archetype != nullptr && info.archetype->size() > info.archetype_index)
+    entity_info& info = get_entity_info(entity_index);
+    if (info.archetype != nullptr && info.archetype->contains(info.archetype_index))
     {
         auto iter = info.archetype->begin() + info.archetype_index;
         std::size_t swap_entity_index = iter.get_component<entity_record>().entity_index;
-        m_entity_infos[swap_entity_index].archetype_index = info.archetype_index;
-        ++m_entity_infos[swap_entity_index].component_version;
+        get_entity_info(swap_entity_index).archetype_index = info.archetype_index;
+        ++get_entity_info(swap_entity_index).component_version;
     }
 
-    m_entity_infos[entity_index].archetype = new_archetype;
-    m_entity_infos[entity_index].archetype_index = new_archetype_index;
-    ++m_entity_infos[entity_index].component_version;
+    get_entity_info(entity_index).archetype = new_archetype;
+    get_entity_info(entity_index).archetype_index = new_archetype_index;
+    ++get_entity_info(entity_index).component_version;
 }
 
 archetype* world::make_archetype(const std::vector<component_id>& components)
 {
+    component_mask mask;
+    for (component_id id : components)
+        mask.set(id);
+
     auto result = std::make_unique<archetype>(
         components,
         m_component_table,
-        m_archetype_chunk_allocator.get());
-    return (m_archetypes[result->get_mask()] = std::move(result)).get();
+        get_chunk_allocator(mask),
+        m_change_version);
+
+    {
+        std::lock_guard<std::mutex> lock(m_query_lock);
+        for (auto& [key, archetypes] : m_queries)
+        {
+            if ((mask & key.include) == key.include && (mask & key.exclude).none())
+                archetypes.push_back(result.get());
+        }
+    }
+
+    return (m_archetypes[mask] = std::move(result)).get();
+}
+
+const std::vector<archetype*>& world::get_archetypes(
+    const component_mask& include,
+    const component_mask& exclude)
+{
+    std::lock_guard<std::mutex> lock(m_query_lock);
+
+    auto [iter, inserted] = m_queries.try_emplace({include, exclude});
+    if (inserted)
+    {
+        for (auto& [mask, archetype] : m_archetypes)
+        {
+            if ((mask & include) == include && (mask & exclude).none())
+                iter->second.push_back(archetype.get());
+        }
+    }
+    return iter->second;
+}
+
+std::vector<entity> world::create_batch(archetype* archetype, std::span<actor* const> owners)
+{
+    std::vector<entity> result(owners.size());
+    for (entity& entity : result)
+        entity = reserve_entity();
+
+    place_batch(archetype, owners, result);
+
+    return result;
+}
+
+void world::place_batch(
+    archetype* archetype,
+    std::span<actor* const> owners,
+    std::span<entity> entities)
+{
+    assert(owners.size() == entities.size());
+
+    std::vector<std::size_t> indices(entities.size());
+    archetype->add(owners, indices);
+    for (std::size_t i = 0; i < entities.size(); ++i)
+    {
+        assert(is_valid(entities[i]).first);
+
+        entity_info& info = get_entity_info(entities[i].index);
+        assert(info.archetype == nullptr);
+
+        info.archetype = archetype;
+        info.archetype_index = indices[i];
+        entities[i].component_version = ++info.component_version;
+
+        auto iter = archetype->begin() + info.archetype_index;
+        iter.get_component<entity_record>().entity_index = entities[i].index;
+    }
+}
+
+void world::push_free_entity(std::uint32_t index) noexcept
+{
+    std::uint64_t head = m_free_entity.load(std::memory_order_relaxed);
+    std::uint64_t tag;
+    do
+    {
+        get_entity_info(index).next_free.store(
+            static_cast<std::uint32_t>(head),
+            std::memory_order_relaxed);
+        tag = (head >> 32) + 1;
+    } while (!m_free_entity.compare_exchange_weak(
+        head,
+        (tag << 32) | index,
+        std::memory_order_release,
+        std::memory_order_relaxed));
+}
+
+archetype* world::get_or_create_archetype(const component_mask& mask)
+{
+    auto iter = m_archetypes.find(mask);
+    if (iter != m_archetypes.cend())
+        return iter->second.get();
+
+    std::vector<component_id> components;
+    for (std::size_t i = 0; i < MAX_COMPONENT; ++i)
+    {
+        if (mask.test(i))
+            components.push_back(static_cast<component_id>(i));
+    }
+    return make_archetype(components);
+}
+
+archetype* world::get_add_archetype(archetype* source, component_id component)
+{
+    assert(!source->get_mask().test(component));
+
+    if (archetype* target = source->get_add_edge(component))
+        return target;
+
+    component_mask mask = source->get_mask();
+    mask.set(component);
+
+    archetype* target = get_or_create_archetype(mask);
+
+    source->set_add_edge(component, target);
+    target->set_remove_edge(component, source);
+
+    return target;
+}
+
+archetype* world::get_remove_archetype(archetype* source, component_id component)
+{
+    assert(source->get_mask().test(component));
+
+    if (archetype* target = source->get_remove_edge(component))
+        return target;
+
+    component_mask mask = source->get_mask();
+    mask.reset(component);
+
+    archetype* target = get_or_create_archetype(mask);
+
+    source->set_remove_edge(component, target);
+    target->set_add_edge(component, source);
+
+    return target;
+}
+
+void world::set_shared_component(entity entity, component_id component, const void* value)
+{
+    assert(is_valid(entity).first);
+
+    entity_info& info = get_entity_info(entity.index);
+    archetype* old_archetype = info.archetype;
+    assert(old_archetype != nullptr);
+
+    shared_component_list shared_components = old_archetype->get_shared_components(
+        info.archetype_index / old_archetype->entity_per_chunk());
+
+    auto iter = std::find_if(
+        shared_components.begin(),
+        shared_components.end(),
+        [component](const auto& pair)
+        {
+            return pair.first >= component;
+        });
+    if (iter != shared_components.end() && iter->first == component)
+    {
+        if (iter->second == value)
+            return;
+        iter->second = value;
+    }
+    else
+    {
+        shared_components.insert(iter, {component, value});
+    }
+
+    // Values of the same components are kept in the same archetype.
+    archetype* new_archetype = old_archetype->get_mask().test(component)
+                                   ? old_archetype
+                                   : get_add_archetype(old_archetype, component);
+
+    std::size_t new_archetype_index =
+        old_archetype->move(info.archetype_index, *new_archetype, shared_components);
+    on_entity_move(entity.index, new_archetype, new_archetype_index);
+}
+
+std::size_t world::trim()
+{
+    std::size_t result = 0;
+    for (auto& [_, allocator] : m_chunk_allocators)
+        result += allocator->trim();
+    return result;
+}
+
+world_memory_stats world::get_memory_stats() const
+{
+    world_memory_stats result = {};
+
+    for (auto& [_, archetype] : m_archetypes)
+    {
+        std::size_t entity_size = 0;
+        for (component_id id : archetype->get_components())
+        {
+            if (m_component_table[id]->has_storage())
+                entity_size += m_component_table[id]->size();
+        }
+        result.used_bytes += entity_size * archetype->size();
+    }
+
+    for (auto& [chunk_size, allocator] : m_chunk_allocators)
+    {
+        result.allocated_bytes += allocator->get_used_count() * chunk_size;
+        result.reserved_bytes += allocator->get_reserved_count() * chunk_size;
+    }
+
+    return result;
+}
+
+archetype_chunk_allocator* world::get_chunk_allocator(const component_mask& mask)
+{
+    auto iter = m_chunk_sizes.find(mask);
+    std::size_t chunk_size = iter == m_chunk_sizes.end() ? m_chunk_size : iter->second;
+
+    // Round up so that columns of every chunk start on a cache line.
+    constexpr std::size_t chunk_align = alignof(archetype_chunk);
+    chunk_size = (chunk_size + chunk_align - 1) / chunk_align * chunk_align;
+
+    auto& allocator = m_chunk_allocators[chunk_size];
+    if (allocator == nullptr)
+        allocator = std::make_unique<archetype_chunk_allocator>(chunk_size);
+    return allocator.get();
+}
+
+std::size_t world::reorder(
+    archetype* archetype,
+    const std::vector<std::size_t>& indices,
+    const std::vector<std::size_t>& order,
+    std::size_t max_swap)
+{
+    assert(order.size() == archetype->size() && indices.size() == order.size());
+
+    // The original index of the entity at each position, and the position of each original index.
+    std::vector<std::size_t> current(order.size());
+    std::vector<std::size_t> position(order.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        current[i] = i;
+        position[i] = i;
+    }
+
+    std::size_t result = 0;
+    for (std::size_t i = 0; i < order.size() && result < max_swap; ++i)
+    {
+        if (current[i] == order[i])
+            continue;
+
+        std::size_t j = position[order[i]];
+        archetype->swap(indices[i], indices[j]);
+
+        std::swap(current[i], current[j]);
+        position[current[i]] = i;
+        position[current[j]] = j;
+
+        for (std::size_t index : {indices[i], indices[j]})
+        {
+            std::size_t entity_index =
+                static_cast<entity_record*>(
+                    archetype->get_component(index, component_index::value<entity_record>()))
+                    ->entity_index;
+            get_entity_info(entity_index).archetype_index = index;
+            ++get_entity_info(entity_index).component_version;
+        }
+
+        ++result;
+    }
+
+    return result;
 }
-} // namespace violet
\ No newline at end of file
+} // namespace violet
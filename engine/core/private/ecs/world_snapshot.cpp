@@ -0,0 +1,498 @@
+#include "core/ecs/world.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace violet
+{
+namespace
+{
+static constexpr std::uint32_t SNAPSHOT_MAGIC = 0x4e535756; // "VWSN"
+static constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+
+// Raw column data is aligned, so it can be copied with aligned loads from a mapped file.
+static constexpr std::size_t SNAPSHOT_COLUMN_ALIGN = 64;
+
+static constexpr component_id SNAPSHOT_UNKNOWN_COMPONENT = -1;
+
+enum snapshot_column_type : std::uint32_t
+{
+    SNAPSHOT_COLUMN_TYPE_RAW,
+    SNAPSHOT_COLUMN_TYPE_SERIALIZED,
+    SNAPSHOT_COLUMN_TYPE_DEFAULT
+};
+
+struct snapshot_header
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t component_count;
+    std::uint32_t archetype_count;
+    // One past the largest saved entity index.
+    std::uint32_t entity_index_count;
+    std::uint32_t padding;
+};
+
+struct snapshot_component
+{
+    std::uint64_t type_hash;
+    std::uint32_t size;
+    std::uint32_t flags;
+};
+
+// Followed by the component indices of the archetype and its columns. Empty archetypes are not
+// saved.
+struct snapshot_archetype
+{
+    std::uint32_t component_count;
+    std::uint32_t column_count;
+    std::uint64_t entity_count;
+};
+
+// Followed by the column data, aligned to SNAPSHOT_COLUMN_ALIGN.
+struct snapshot_column
+{
+    std::uint32_t component;
+    snapshot_column_type type;
+    std::uint64_t size;
+};
+
+class snapshot_writer
+{
+public:
+    snapshot_writer(std::vector<std::uint8_t>& data) noexcept : m_data(data) {}
+
+    template <typename T>
+    void write(const T& value)
+    {
+        write(&value, sizeof(T));
+    }
+
+    void write(const void* data, std::size_t size)
+    {
+        auto* begin = static_cast<const std::uint8_t*>(data);
+        m_data.insert(m_data.end(), begin, begin + size);
+    }
+
+    void align(std::size_t align) { m_data.resize((m_data.size() + align - 1) / align * align); }
+
+private:
+    std::vector<std::uint8_t>& m_data;
+};
+
+class snapshot_reader
+{
+public:
+    snapshot_reader(std::span<const std::uint8_t> data) noexcept : m_data(data), m_offset(0) {}
+
+    template <typename T>
+    bool read(T& result)
+    {
+        const std::uint8_t* data = read(sizeof(T));
+        if (data == nullptr)
+            return false;
+
+        std::memcpy(&result, data, sizeof(T));
+        return true;
+    }
+
+    /**
+     * @return const std::uint8_t* nullptr when the data ends before size bytes.
+     */
+    const std::uint8_t* read(std::uint64_t size)
+    {
+        if (size > get_remaining())
+            return nullptr;
+
+        const std::uint8_t* result = m_data.data() + m_offset;
+        m_offset += static_cast<std::size_t>(size);
+        return result;
+    }
+
+    void align(std::size_t align)
+    {
+        m_offset = std::min((m_offset + align - 1) / align * align, m_data.size());
+    }
+
+    std::size_t get_remaining() const noexcept { return m_data.size() - m_offset; }
+
+private:
+    std::span<const std::uint8_t> m_data;
+    std::size_t m_offset;
+};
+
+struct snapshot_column_data
+{
+    snapshot_column column;
+    const std::uint8_t* data;
+};
+
+struct snapshot_archetype_data
+{
+    std::uint64_t entity_count;
+    std::vector<std::uint32_t> components;
+    std::vector<snapshot_column_data> columns;
+};
+
+/**
+ * @brief Check every count, size and index of a snapshot against its data before anything is
+ * loaded, so a truncated or corrupt snapshot is rejected without touching the world.
+ */
+bool parse_snapshot(
+    std::span<const std::uint8_t> snapshot,
+    snapshot_header& header,
+    std::vector<snapshot_component>& components,
+    std::vector<snapshot_archetype_data>& archetypes)
+{
+    snapshot_reader reader(snapshot);
+
+    if (!reader.read(header) || header.magic != SNAPSHOT_MAGIC ||
+        header.version != SNAPSHOT_VERSION)
+        return false;
+
+    if (header.component_count > reader.get_remaining() / sizeof(snapshot_component))
+        return false;
+
+    components.resize(header.component_count);
+    for (snapshot_component& component : components)
+        reader.read(component);
+
+    const std::uint64_t record_hash = get_component_type_hash<entity_record>();
+
+    for (std::uint32_t i = 0; i < header.archetype_count; ++i)
+    {
+        snapshot_archetype archetype_header;
+        if (!reader.read(archetype_header) ||
+            archetype_header.component_count > reader.get_remaining() / sizeof(std::uint32_t))
+            return false;
+
+        snapshot_archetype_data& archetype = archetypes.emplace_back();
+        archetype.entity_count = archetype_header.entity_count;
+
+        archetype.components.resize(archetype_header.component_count);
+        for (std::uint32_t& component : archetype.components)
+        {
+            reader.read(component);
+            if (component >= header.component_count)
+                return false;
+        }
+
+        // Columns are only written into components of the archetype, each at most once.
+        std::vector<bool> has_column(header.component_count, false);
+
+        bool has_record = false;
+        for (std::uint32_t j = 0; j < archetype_header.column_count; ++j)
+        {
+            snapshot_column_data& column = archetype.columns.emplace_back();
+            if (!reader.read(column.column) || column.column.component >= header.component_count ||
+                column.column.type > SNAPSHOT_COLUMN_TYPE_DEFAULT ||
+                has_column[column.column.component] ||
+                std::find(
+                    archetype.components.begin(),
+                    archetype.components.end(),
+                    column.column.component) == archetype.components.end())
+                return false;
+            has_column[column.column.component] = true;
+
+            reader.align(SNAPSHOT_COLUMN_ALIGN);
+            column.data = reader.read(column.column.size);
+            if (column.data == nullptr)
+                return false;
+
+            const snapshot_component& component = components[column.column.component];
+            if (column.column.type == SNAPSHOT_COLUMN_TYPE_RAW &&
+                (component.size == 0 || column.column.size % component.size != 0 ||
+                 column.column.size / component.size != archetype.entity_count))
+                return false;
+
+            if (component.type_hash == record_hash)
+            {
+                if (column.column.type != SNAPSHOT_COLUMN_TYPE_RAW ||
+                    component.size != sizeof(entity_record))
+                    return false;
+
+                for (std::uint64_t k = 0; k < archetype.entity_count; ++k)
+                {
+                    entity_record record;
+                    std::memcpy(
+                        &record,
+                        column.data + k * sizeof(entity_record),
+                        sizeof(entity_record));
+                    if (record.entity_index >= header.entity_index_count)
+                        return false;
+                }
+
+                has_record = true;
+            }
+        }
+
+        // Every entity has a record, which also bounds the entity count by the size of the data.
+        if (!has_record)
+            return false;
+    }
+
+    return true;
+}
+} // namespace
+
+std::vector<std::uint8_t> world::save() const
+{
+    std::vector<std::uint8_t> result;
+    snapshot_writer writer(result);
+
+    // Saved components are referred to by their index in the component table of the snapshot.
+    std::vector<std::uint32_t> component_indices(MAX_COMPONENT, -1);
+    std::vector<snapshot_component> components;
+    for (std::size_t i = 0; i < MAX_COMPONENT; ++i)
+    {
+        if (m_component_table[i] == nullptr || m_component_table[i]->is_shared())
+            continue;
+
+        component_indices[i] = static_cast<std::uint32_t>(components.size());
+        components.push_back(
+            {m_component_table[i]->get_type_hash(),
+             static_cast<std::uint32_t>(m_component_table[i]->size()),
+             m_component_table[i]->get_flags()});
+    }
+
+    snapshot_header header = {};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.component_count = static_cast<std::uint32_t>(components.size());
+    header.entity_index_count = m_entity_count.load(std::memory_order_relaxed);
+    for (auto& [key, archetype] : m_archetypes)
+    {
+        if (archetype->size() != 0)
+            ++header.archetype_count;
+    }
+    writer.write(header);
+
+    for (const snapshot_component& component : components)
+        writer.write(component);
+
+    const component_id actor_id = component_index::value<actor*>();
+
+    std::vector<std::uint8_t> serialized;
+    for (auto& [key, archetype] : m_archetypes)
+    {
+        if (archetype->size() == 0)
+            continue;
+
+        std::vector<std::uint32_t> archetype_components;
+        std::vector<component_id> columns;
+        for (component_id id : archetype->get_components())
+        {
+            const component_info& info = *m_component_table[id];
+            if (info.is_shared())
+                continue;
+
+            archetype_components.push_back(component_indices[id]);
+            if (info.has_storage())
+                columns.push_back(id);
+        }
+
+        snapshot_archetype archetype_header = {};
+        archetype_header.component_count = static_cast<std::uint32_t>(archetype_components.size());
+        archetype_header.column_count = static_cast<std::uint32_t>(columns.size());
+        archetype_header.entity_count = archetype->size();
+        writer.write(archetype_header);
+        writer.write(
+            archetype_components.data(),
+            archetype_components.size() * sizeof(std::uint32_t));
+
+        for (component_id id : columns)
+        {
+            component_info& info = *m_component_table[id];
+
+            snapshot_column column = {};
+            column.component = component_indices[id];
+
+            serialized.clear();
+            if (id == actor_id)
+            {
+                column.type = SNAPSHOT_COLUMN_TYPE_DEFAULT;
+            }
+            else if (info.is_trivially_copyable())
+            {
+                column.type = SNAPSHOT_COLUMN_TYPE_RAW;
+                column.size = info.size() * archetype->size();
+            }
+            else
+            {
+                column.type = SNAPSHOT_COLUMN_TYPE_SERIALIZED;
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+                {
+                    if (archetype->get_chunk_size(i) == 0)
+                        continue;
+
+                    auto* data =
+                        static_cast<const std::uint8_t*>(archetype->get_component_array(i, id));
+                    for (std::size_t j = 0; j < archetype->get_chunk_size(i); ++j)
+                    {
+                        if (!info.serialize(data + j * info.size(), serialized))
+                        {
+                            column.type = SNAPSHOT_COLUMN_TYPE_DEFAULT;
+                            break;
+                        }
+                    }
+
+                    if (column.type == SNAPSHOT_COLUMN_TYPE_DEFAULT)
+                        break;
+                }
+
+                column.size = column.type == SNAPSHOT_COLUMN_TYPE_DEFAULT ? 0 : serialized.size();
+            }
+
+            writer.write(column);
+            writer.align(SNAPSHOT_COLUMN_ALIGN);
+
+            if (column.type == SNAPSHOT_COLUMN_TYPE_RAW)
+            {
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+                {
+                    if (archetype->get_chunk_size(i) == 0)
+                        continue;
+
+                    writer.write(
+                        archetype->get_component_array(i, id),
+                        info.size() * archetype->get_chunk_size(i));
+                }
+            }
+            else if (column.type == SNAPSHOT_COLUMN_TYPE_SERIALIZED)
+            {
+                writer.write(serialized.data(), serialized.size());
+            }
+        }
+    }
+
+    return result;
+}
+
+std::vector<entity> world::load(std::span<const std::uint8_t> snapshot)
+{
+    snapshot_header header;
+    std::vector<snapshot_component> components;
+    std::vector<snapshot_archetype_data> archetypes;
+    if (!parse_snapshot(snapshot, header, components, archetypes))
+        return {};
+
+    std::uint64_t entity_count = 0;
+    for (const snapshot_archetype_data& archetype : archetypes)
+        entity_count += archetype.entity_count;
+
+    const std::uint64_t max_entity_count = MAX_ENTITY_PAGE * ENTITY_PAGE_SIZE;
+    if (header.entity_index_count > max_entity_count ||
+        entity_count > max_entity_count - m_entity_count.load(std::memory_order_relaxed))
+        return {};
+
+    std::unordered_map<std::uint64_t, component_id> registered;
+    for (std::size_t i = 0; i < MAX_COMPONENT; ++i)
+    {
+        if (m_component_table[i] != nullptr && !m_component_table[i]->is_shared())
+            registered[m_component_table[i]->get_type_hash()] = static_cast<component_id>(i);
+    }
+
+    // Map the components of the snapshot to the components of this world, skipping components that
+    // are unknown or have changed size.
+    std::vector<component_id> component_ids(header.component_count, SNAPSHOT_UNKNOWN_COMPONENT);
+    for (std::uint32_t i = 0; i < header.component_count; ++i)
+    {
+        auto iter = registered.find(components[i].type_hash);
+        if (iter != registered.end() &&
+            m_component_table[iter->second]->size() == components[i].size)
+            component_ids[i] = iter->second;
+    }
+
+    std::vector<entity> result(header.entity_index_count);
+
+    const component_id record_id = component_index::value<entity_record>();
+
+    std::vector<actor*> owners;
+    std::vector<entity> entities;
+    for (const snapshot_archetype_data& archetype_data : archetypes)
+    {
+        if (archetype_data.entity_count == 0)
+            continue;
+
+        component_mask mask;
+        mask.set(component_index::value<actor*>());
+        mask.set(record_id);
+        for (std::uint32_t component : archetype_data.components)
+        {
+            component_id id = component_ids[component];
+            if (id != SNAPSHOT_UNKNOWN_COMPONENT)
+                mask.set(id);
+        }
+
+        archetype* archetype = get_or_create_archetype(mask);
+
+        auto count = static_cast<std::size_t>(archetype_data.entity_count);
+        owners.assign(count, nullptr);
+        entities.resize(count);
+        for (entity& entity : entities)
+            entity = reserve_entity();
+        place_batch(archetype, owners, entities);
+
+        // Placed entities fill a chunk before they continue at the start of the next one.
+        std::size_t entity_per_chunk = archetype->entity_per_chunk();
+
+        for (const auto& [column, data] : archetype_data.columns)
+        {
+            component_id id = component_ids[column.component];
+            if (id == SNAPSHOT_UNKNOWN_COMPONENT || column.type == SNAPSHOT_COLUMN_TYPE_DEFAULT ||
+                !m_component_table[id]->has_storage())
+                continue;
+
+            component_info& info = *m_component_table[id];
+
+            if (id == record_id)
+            {
+                // The saved entity records are only used to map old entities to new ones, the
+                // records of the placed entities are already correct.
+                for (std::size_t k = 0; k < count; ++k)
+                {
+                    entity_record record;
+                    std::memcpy(&record, data + k * sizeof(entity_record), sizeof(entity_record));
+                    result[record.entity_index] = entities[k];
+                }
+            }
+            else if (column.type == SNAPSHOT_COLUMN_TYPE_RAW)
+            {
+                for (std::size_t k = 0; k < count;)
+                {
+                    std::size_t index = get_entity_info(entities[k].index).archetype_index;
+                    std::size_t chunk_index = index / entity_per_chunk;
+                    std::size_t entity_index = index % entity_per_chunk;
+                    std::size_t run = std::min(count - k, entity_per_chunk - entity_index);
+
+                    auto* target =
+                        static_cast<std::uint8_t*>(archetype->get_component_array(chunk_index, id));
+                    std::memcpy(
+                        target + entity_index * info.size(),
+                        data + k * info.size(),
+                        run * info.size());
+
+                    k += run;
+                }
+            }
+            else
+            {
+                std::span<const std::uint8_t> source(data, static_cast<std::size_t>(column.size));
+                for (std::size_t k = 0; k < count; ++k)
+                {
+                    // An invalid column leaves the rest of its components default constructed.
+                    std::size_t size = info.deserialize(
+                        source,
+                        archetype->get_component(
+                            get_entity_info(entities[k].index).archetype_index,
+                            id));
+                    if (size == 0 || size > source.size())
+                        break;
+                    source = source.subspan(size);
+                }
+            }
+        }
+    }
+
+    return result;
+}
+} // namespace violet
@@ -1,5 +1,6 @@
 #include "core/engine.hpp"
 #include "common/log.hpp"
+#include "core/task/task_profiler.hpp"
 #include "engine_context.hpp"
 #include <filesystem>
 #include <fstream>
@@ -81,21 +82,76 @@ void engine::run()
     else
         m_exit = false;
 
+    dictionary& config = m_config["engine"];
+
+    std::vector<task_pool_desc> pools;
+    if (config.contains("task_pools"))
+    {
+        for (auto& pool_config : config["task_pools"])
+        {
+            task_pool_desc pool = {};
+            pool.name = pool_config.value("name", "frame");
+            pool.thread_count = pool_config.value("thread_count", 0);
+            pool.numa_node = pool_config.value("numa_node", -1);
+            pool.pin = pool_config.value("pin", false);
+            pool.first_processor = pool_config.value("first_processor", 0);
+            pools.push_back(pool);
+        }
+    }
+    if (pools.empty())
+        pools.push_back({"frame", config.value<std::size_t>("task_thread_count", 0)});
+
     task_executor& executor = m_context->get_task_executor();
-    executor.run();
+    executor.run(pools);
 
     frame_rater<30> frame_rater;
     timer& time = m_context->get_timer();
     time.tick(timer::point::FRAME_START);
     time.tick(timer::point::FRAME_END);
 
+    bool pipelined = config.contains("pipelined") && config["pipelined"].get<bool>();
+
+#ifdef VIOLET_TASK_PROFILER
+    task_profiler::get().set_thread_name("main");
+#endif
+
+    // Index of the frame extracted at the end of this iteration.
+    std::size_t frame = 0;
+
     while (!m_exit)
     {
         time.tick(timer::point::FRAME_START);
 
+#ifdef VIOLET_TASK_PROFILER
+        task_profiler::get().begin_frame();
+#endif
+
+        executor.begin_frame();
+
         executor.execute_sync(m_context->get_frame_begin_task());
-        executor.execute_sync(m_context->get_tick_task(), time.get_frame_delta());
-        executor.execute_sync(m_context->get_frame_end_task());
+
+        if (pipelined)
+        {
+            // Render the data extracted at the end of the previous frame while ticking this one.
+            task_future render;
+            if (frame != 0)
+                render = executor.execute(m_context->get_render_task(), frame - 1);
+            executor.execute_sync(m_context->get_tick_task(), time.get_frame_delta());
+            executor.execute_sync(m_context->get_frame_end_task());
+
+            // The render stage may still reference components, so it has to finish before the
+            // structural changes of this frame are played back.
+            executor.wait(render);
+        }
+        else
+        {
+            executor.execute_sync(m_context->get_tick_task(), time.get_frame_delta());
+            executor.execute_sync(m_context->get_frame_end_task());
+            executor.execute_sync(m_context->get_render_task(), frame);
+        }
+
+        m_context->get_world().playback();
+        ++frame;
 
         time.tick(timer::point::FRAME_END);
 
@@ -25,6 +25,7 @@ public:
     task_graph<>& get_frame_begin_task() { return m_frame_begin; }
     task_graph<>& get_frame_end_task() { return m_frame_end; }
     task_graph<float>& get_tick_task() { return m_tick; }
+    task_graph<std::size_t>& get_render_task() { return m_render; }
 
     engine_context& operator=(const engine_context&) = delete;
 
@@ -39,6 +40,7 @@ private:
     task_graph<> m_frame_begin;
     task_graph<> m_frame_end;
     task_graph<float> m_tick;
+    task_graph<std::size_t> m_render;
 
     std::atomic<bool> m_exit;
 };
@@ -41,4 +41,9 @@ task<float>& engine_system::on_tick()
 {
     return m_context->get_tick_task().get_root();
 }
+
+task<std::size_t>& engine_system::on_render()
+{
+    return m_context->get_render_task().get_root();
+}
 } // namespace violet
\ No newline at end of file
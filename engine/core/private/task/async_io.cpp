@@ -0,0 +1,87 @@
+#include "task/async_io.hpp"
+#include <fstream>
+
+namespace violet
+{
+async_io::async_io(std::function<void(task_base*)> resume)
+    : m_resume(std::move(resume)),
+      m_stop(false)
+{
+    m_thread = std::thread(
+        [this]()
+        {
+            run();
+        });
+}
+
+async_io::~async_io()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_lock);
+        m_stop = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+void async_io::read_file(task_read_awaiter* request)
+{
+    // Notified under the lock, the coroutine may be resumed and the executor stopped as soon as
+    // the request is queued.
+    std::lock_guard<std::mutex> lg(m_lock);
+    m_reads.push_back(request);
+    m_condition.notify_one();
+}
+
+void async_io::delay(task_delay_awaiter* request)
+{
+    // Notified under the lock, see read_file.
+    std::lock_guard<std::mutex> lg(m_lock);
+    m_timers.push({request->m_time, request});
+    m_condition.notify_one();
+}
+
+void async_io::run()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stop)
+    {
+        if (!m_timers.empty() && m_timers.top().time <= std::chrono::steady_clock::now())
+        {
+            task_delay_awaiter* request = m_timers.top().request;
+            m_timers.pop();
+
+            lock.unlock();
+            m_resume(&request->m_resume);
+            lock.lock();
+        }
+        else if (!m_reads.empty())
+        {
+            task_read_awaiter* request = m_reads.front();
+            m_reads.pop_front();
+
+            lock.unlock();
+
+            std::ifstream fin(request->m_path, std::ios::binary | std::ios::ate);
+            if (fin.is_open())
+            {
+                request->m_data.resize(static_cast<std::size_t>(fin.tellg()));
+                fin.seekg(0);
+                fin.read(reinterpret_cast<char*>(request->m_data.data()), request->m_data.size());
+                request->m_result = fin.good();
+            }
+            m_resume(&request->m_resume);
+
+            lock.lock();
+        }
+        else if (!m_timers.empty())
+        {
+            m_condition.wait_until(lock, m_timers.top().time);
+        }
+        else
+        {
+            m_condition.wait(lock);
+        }
+    }
+}
+} // namespace violet
\ No newline at end of file
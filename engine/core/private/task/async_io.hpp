@@ -0,0 +1,45 @@
+#pragma once
+
+#include "core/task/async_task.hpp"
+#include <deque>
+#include <functional>
+#include <queue>
+
+namespace violet
+{
+/**
+ * @brief Thread that waits for timers and reads files for coroutines, so workers never block on
+ * them. The resume task of a finished request is handed to the resume callback.
+ */
+class async_io
+{
+public:
+    async_io(std::function<void(task_base*)> resume);
+    ~async_io();
+
+    void read_file(task_read_awaiter* request);
+    void delay(task_delay_awaiter* request);
+
+private:
+    struct timer
+    {
+        std::chrono::steady_clock::time_point time;
+        task_delay_awaiter* request;
+
+        bool operator>(const timer& other) const noexcept { return time > other.time; }
+    };
+
+    void run();
+
+    std::function<void(task_base*)> m_resume;
+
+    std::deque<task_read_awaiter*> m_reads;
+    std::priority_queue<timer, std::vector<timer>, std::greater<timer>> m_timers;
+
+    bool m_stop;
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    std::thread m_thread;
+};
+} // namespace violet
\ No newline at end of file
@@ -0,0 +1,32 @@
+#include "core/task/async_task.hpp"
+#include "core/task/task_executor.hpp"
+#include "task/async_io.hpp"
+
+namespace violet
+{
+void task_switch_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_resume.set_handle(handle);
+    m_executor->execute_task(&m_resume);
+}
+
+void task_frame_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_resume.set_handle(handle);
+
+    std::lock_guard<std::mutex> lg(m_executor->m_frame_lock);
+    m_executor->m_frame_waiters.push_back(&m_resume);
+}
+
+void task_delay_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_resume.set_handle(handle);
+    m_executor->m_io->delay(this);
+}
+
+void task_read_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_resume.set_handle(handle);
+    m_executor->m_io->read_file(this);
+}
+} // namespace violet
\ No newline at end of file
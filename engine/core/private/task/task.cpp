@@ -1,12 +1,18 @@
 #include "core/task/task.hpp"
+#include "core/task/task_executor.hpp"
+#include <algorithm>
+#include <cassert>
 #include <queue>
 
 namespace violet
 {
 task_base::task_base(task_option option, task_graph_base* graph) noexcept
     : m_uncompleted_dependency_count(0),
+      m_next_ready(nullptr),
       m_option(option),
-      m_graph(graph)
+      m_graph(graph),
+      m_priority(0),
+      m_manual_priority(0)
 {
 }
 
@@ -14,13 +20,18 @@ task_base::~task_base()
 {
 }
 
-std::vector<task_base*> task_base::execute()
+task_base* task_base::execute()
 {
     execute_impl();
+    return complete();
+}
 
-    std::vector<task_base*> result;
-    for (task_base* successor : m_successors)
+task_base* task_base::complete()
+{
+    task_base* result = nullptr;
+    for (auto iter = m_successors.rbegin(); iter != m_successors.rend(); ++iter)
     {
+        task_base* successor = *iter;
         successor->m_uncompleted_dependency_count.fetch_sub(1);
 
         std::uint32_t expected = 0;
@@ -28,7 +39,8 @@ std::vector<task_base*> task_base::execute()
                 expected,
                 static_cast<std::uint32_t>(successor->m_dependents.size())))
         {
-            result.push_back(successor);
+            successor->m_next_ready = result;
+            result = successor;
         }
     }
 
@@ -68,6 +80,32 @@ std::vector<task_base*> task_base::visit()
     return result;
 }
 
+void task_base::set_priority(std::uint32_t priority) noexcept
+{
+    m_manual_priority = priority;
+    m_priority = priority;
+
+    // Priorities are computed when the graph is reset.
+    if (m_graph != nullptr)
+        m_graph->m_dirty = true;
+}
+
+void task_base::update_priority()
+{
+    std::stable_sort(
+        m_successors.begin(),
+        m_successors.end(),
+        [](task_base* a, task_base* b)
+        {
+            return a->m_priority > b->m_priority;
+        });
+
+    if (m_manual_priority != 0)
+        m_priority = m_manual_priority;
+    else
+        m_priority = m_successors.empty() ? 1 : m_successors.front()->m_priority + 1;
+}
+
 void task_base::add_successor(task_base* successor)
 {
     m_successors.push_back(successor);
@@ -75,32 +113,60 @@ void task_base::add_successor(task_base* successor)
     ++successor->m_uncompleted_dependency_count;
 }
 
-task_graph_base::task_graph_base() noexcept : m_dirty(false), m_incomplete_count(0)
+task_graph_base::task_graph_base() noexcept
+    : m_executor(nullptr),
+      m_dirty(false),
+      m_incomplete_count(0)
 {
 }
 
-std::future<void> task_graph_base::reset(task_base* root) noexcept
+task_future task_graph_base::reset(task_base* root) noexcept
 {
     if (m_dirty)
     {
         m_accessible_tasks = root->visit();
+
+        // Tasks are visited in topological order, so in reverse the successors of a task are
+        // updated before it.
+        for (auto iter = m_accessible_tasks.rbegin(); iter != m_accessible_tasks.rend(); ++iter)
+            (*iter)->update_priority();
+
         m_dirty = false;
     }
-    m_incomplete_count = m_accessible_tasks.size();
-    m_promise = std::promise<void>();
+    m_incomplete_count = static_cast<std::uint32_t>(m_accessible_tasks.size());
 
-    return m_promise.get_future();
+    return task_future(this);
 }
 
 void task_graph_base::on_task_complete()
 {
-    m_incomplete_count.fetch_sub(1);
+    // Read before the count drops, a waiting thread may destroy the graph right after, so the graph
+    // is not touched once the count is zero and waiters are woken through the executor.
+    task_executor* executor = m_executor;
+
+    if (m_incomplete_count.fetch_sub(1) == 1 && executor != nullptr)
+        executor->notify_complete();
+}
+
+void task_graph_base::wait() const
+{
+    assert(is_complete() || m_executor != nullptr);
 
-    std::uint32_t expected = 0;
-    if (m_incomplete_count.compare_exchange_strong(
-            expected,
-            static_cast<std::uint32_t>(m_accessible_tasks.size())))
-        m_promise.set_value();
+    while (!is_complete())
+    {
+        // Loaded before checking the count, a completion after the check changes the epoch.
+        std::uint32_t epoch = m_executor->m_wait_epoch.load();
+        if (is_complete())
+            break;
+
+        m_executor->m_wait_epoch.wait(epoch);
+    }
+}
+
+void task_future::wait() const
+{
+    if (m_graph != nullptr)
+        m_graph->wait();
 }
 
 std::size_t task_graph_base::get_task_count(int option) const noexcept
@@ -1,38 +1,132 @@
 #include "core/task/task_executor.hpp"
 #include "common/log.hpp"
+#include "core/task/task_profiler.hpp"
+#include "task/async_io.hpp"
 #include "task/task_queue.hpp"
+#include "task/task_thread.hpp"
+#include "task/work_stealing_queue.hpp"
 
 namespace violet
 {
+class task_executor::worker
+{
+public:
+    worker(task_executor* executor, thread_pool* pool, std::size_t index) noexcept
+        : executor(executor),
+          pool(pool),
+          index(index),
+          random(static_cast<std::uint32_t>(index) * 2654435761u + 1)
+    {
+    }
+
+    std::size_t next_victim(std::size_t worker_count) noexcept
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return random % worker_count;
+    }
+
+    task_executor* executor;
+    thread_pool* pool;
+    std::size_t index;
+
+    std::string name;
+#ifdef VIOLET_TASK_PROFILER
+    std::uint32_t profiler_thread;
+#endif
+
+    work_stealing_queue<task_base*> queue;
+
+    // xorshift state for picking steal victims.
+    std::uint32_t random;
+};
+
 class task_executor::thread_pool
 {
 public:
-    thread_pool(std::size_t thread_count) : m_threads(thread_count) {}
+    thread_pool(const task_pool_desc& desc)
+        : desc(desc),
+          queue(std::make_unique<task_queue_lock_free>()),
+          parked_count(0),
+          wake_epoch(0)
+    {
+    }
+
     ~thread_pool() { join(); }
 
-    template <typename F>
-    void run(F&& functor)
+    void run(task_executor* executor)
     {
-        for (auto& thread : m_threads)
-            thread = std::thread(functor);
+        std::size_t thread_count = desc.thread_count;
+        if (thread_count == 0)
+        {
+            std::size_t processor_count = get_processor_count(desc.numa_node);
+            thread_count =
+                processor_count > desc.first_processor ? processor_count - desc.first_processor : 1;
+        }
+
+        // Every worker exists before any thread starts, workers steal from each other.
+        for (std::size_t i = 0; i < thread_count; ++i)
+        {
+            auto worker = std::make_unique<task_executor::worker>(executor, this, i);
+            worker->name = desc.name + " " + std::to_string(i);
+#ifdef VIOLET_TASK_PROFILER
+            // Allocated here, so workers do not allocate when they record their first task.
+            worker->profiler_thread = task_profiler::get().register_thread(worker->name);
+#endif
+            workers.push_back(std::move(worker));
+        }
+
+        for (auto& worker : workers)
+        {
+            threads.emplace_back(
+                [executor, worker = worker.get()]()
+                {
+                    executor->run_worker(*worker);
+                });
+        }
     }
 
     void join()
     {
-        for (auto& thread : m_threads)
+        for (auto& thread : threads)
         {
             if (thread.joinable())
                 thread.join();
         }
+        threads.clear();
+        workers.clear();
     }
 
-private:
-    std::vector<std::thread> m_threads;
+    task_pool_desc desc;
+
+    // Tasks pushed by threads outside the pool. Workers push to their own queue.
+    std::unique_ptr<task_queue> queue;
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::vector<std::thread> threads;
+
+    // Idle workers park on the wake epoch, which is bumped when work is pushed while any worker is
+    // parked.
+    std::atomic<std::uint32_t> parked_count;
+    std::atomic<std::uint32_t> wake_epoch;
 };
 
-task_executor::task_executor() : m_stop(true)
+namespace
+{
+// Number of rounds an idle worker looks for tasks before it parks.
+static constexpr std::size_t SPIN_COUNT = 64;
+
+// Name of the pool running tasks with TASK_OPTION_BACKGROUND.
+static constexpr std::string_view BACKGROUND_POOL_NAME = "background";
+} // namespace
+
+task_executor::task_executor() : m_wait_epoch(0), m_stop(true)
 {
-    m_queue = std::make_unique<task_queue_thread_safe>();
+    // Tasks pushed before the executor runs wait in the queue of the first pool.
+    m_pools.push_back(std::make_unique<thread_pool>(task_pool_desc{"frame"}));
+    m_background_pool = m_pools[0].get();
+
     m_main_thread_queue = std::make_unique<task_queue_thread_safe>();
 }
 
@@ -43,28 +137,32 @@ task_executor::~task_executor()
 
 void task_executor::run(std::size_t thread_count)
 {
-    if (!m_stop)
+    run({task_pool_desc{"frame", thread_count}});
+}
+
+void task_executor::run(const std::vector<task_pool_desc>& pools)
+{
+    if (!m_stop || pools.empty())
         return;
 
     m_stop = false;
 
-    if (thread_count == 0)
-        thread_count = std::thread::hardware_concurrency();
-
-    m_thread_pool = std::make_unique<thread_pool>(thread_count);
-    m_thread_pool->run(
-        [this]()
+    m_io = std::make_unique<async_io>(
+        [this](task_base* task)
         {
-            while (true)
-            {
-                task_base* current = m_queue->pop();
-                if (!current)
-                    break;
-
-                for (task_base* successor : current->execute())
-                    execute_task(successor);
-            }
+            execute_task(task);
         });
+
+    m_pools[0]->desc = pools[0];
+    for (std::size_t i = 1; i < pools.size(); ++i)
+        m_pools.push_back(std::make_unique<thread_pool>(pools[i]));
+
+    for (auto& pool : m_pools)
+    {
+        if (pool->desc.name == BACKGROUND_POOL_NAME)
+            m_background_pool = pool.get();
+        pool->run(this);
+    }
 }
 
 void task_executor::stop()
@@ -74,32 +172,276 @@ void task_executor::stop()
 
     m_stop = true;
 
-    m_queue->close();
+    // Coroutines still waiting for a timer or a file are not resumed.
+    m_io = nullptr;
+
+    for (auto& pool : m_pools)
+    {
+        pool->wake_epoch.fetch_add(1);
+        pool->wake_epoch.notify_all();
+        pool->queue->close();
+    }
     m_main_thread_queue->close();
-    m_thread_pool->join();
-    m_thread_pool = nullptr;
+
+    for (auto& pool : m_pools)
+        pool->join();
+
+    m_pools.resize(1);
+    m_background_pool = m_pools[0].get();
+}
+
+std::size_t task_executor::get_thread_count() const noexcept
+{
+    return m_pools[0]->workers.size();
 }
 
 void task_executor::execute_task(task_base* task)
 {
+#ifdef VIOLET_TASK_PROFILER
+    task->m_queue_time = task_profiler::now();
+#endif
+
     if ((task->get_option() & TASK_OPTION_MAIN_THREAD) == TASK_OPTION_MAIN_THREAD)
+    {
         m_main_thread_queue->push(task);
+
+        m_wait_epoch.fetch_add(1);
+        m_wait_epoch.notify_all();
+        return;
+    }
+
+    thread_pool& pool =
+        (task->get_option() & TASK_OPTION_BACKGROUND) == TASK_OPTION_BACKGROUND ? *m_background_pool
+                                                                                : *m_pools[0];
+
+    worker* current_worker = get_current_worker();
+    if (current_worker != nullptr && current_worker->pool == &pool)
+        current_worker->queue.push(task);
     else
-        m_queue->push(task);
+        pool.queue->push(task);
+
+    wake_worker(pool);
 }
 
-void task_executor::execute_main_thread_task(std::size_t task_count)
+void task_executor::execute_ready_task(task_base* first)
 {
-    while (task_count > 0)
+    if (first == nullptr)
+        return;
+
+    // The list is sorted by priority. A worker queues the first task last, so it runs it next, and
+    // leaves the others in order at the top of its queue, where thieves take the oldest task.
+    worker* current_worker = get_current_worker();
+    bool local = current_worker != nullptr && current_worker->executor == this;
+
+    task_base* current = local ? first->get_next_ready() : first;
+    while (current != nullptr)
     {
-        task_base* current = m_main_thread_queue->pop();
-        if (!current)
+        // Read the link first, the task may be executed and linked again once it is queued.
+        task_base* next = current->get_next_ready();
+        execute_task(current);
+        current = next;
+    }
+
+    if (local)
+        execute_task(first);
+}
+
+void task_executor::wait(const task_future& future)
+{
+    task_graph_base* graph = future.m_graph;
+    if (graph == nullptr)
+        return;
+
+    worker* current_worker = get_current_worker();
+    if (current_worker != nullptr && current_worker->executor != this)
+        current_worker = nullptr;
+
+    while (!graph->is_complete())
+    {
+        // Loaded before looking for tasks, so a completion or a main thread task pushed after the
+        // search changes the epoch and the wait below returns.
+        std::uint32_t epoch = m_wait_epoch.load();
+
+        // Main thread tasks have affinity to threads outside the pool, and run there first.
+        task_base* current = current_worker == nullptr ? m_main_thread_queue->try_pop() : nullptr;
+        if (current == nullptr)
+            current = find_task(current_worker);
+
+        if (current != nullptr)
+        {
+            execute_ready_task(run_task(current));
+            continue;
+        }
+
+        if (!graph->is_complete())
+            m_wait_epoch.wait(epoch);
+    }
+}
+
+void task_executor::begin_frame()
+{
+    {
+        // A resumed coroutine that waits for a frame again blocks on the lock until the list is
+        // cleared, so it waits for the next frame.
+        std::lock_guard<std::mutex> lg(m_frame_lock);
+        for (task_base* task : m_frame_waiters)
+            execute_task(task);
+        m_frame_waiters.clear();
+    }
+
+    while (task_base* current = m_main_thread_queue->try_pop())
+        execute_ready_task(run_task(current));
+}
+
+void task_executor::run_worker(worker& worker)
+{
+    get_current_worker() = &worker;
+
+    const task_pool_desc& desc = worker.pool->desc;
+
+    set_thread_name(worker.name);
+#ifdef VIOLET_TASK_PROFILER
+    task_profiler::get().attach_thread(worker.profiler_thread);
+#endif
+
+    bool affinity = true;
+    if (desc.pin)
+        affinity = set_thread_affinity(
+            desc.numa_node,
+            static_cast<int>(desc.first_processor + worker.index));
+    else if (desc.numa_node >= 0)
+        affinity = set_thread_affinity(desc.numa_node, -1);
+
+    if (!affinity)
+        log::warn("Failed to set the affinity of task worker {}.", worker.name);
+
+    while (true)
+    {
+        task_base* current = find_task(&worker);
+        if (current == nullptr)
+            current = wait_task(worker);
+        if (current == nullptr)
             break;
 
-        for (task_base* successor : current->execute())
-            execute_task(successor);
+        // Successors go to the bottom of the local queue, so the one with the highest priority runs
+        // next on this thread and the others can be stolen.
+        execute_ready_task(run_task(current));
+    }
+
+    get_current_worker() = nullptr;
+}
+
+task_base* task_executor::run_task(task_base* task)
+{
+#ifdef VIOLET_TASK_PROFILER
+    // Read before executing, the graph may be reset or destroyed once the task completes.
+    const char* name = task->m_name;
+    std::int64_t queue_time = task->m_queue_time;
+
+    std::int64_t begin_time = task_profiler::now();
+    task_base* result = task->execute();
+    task_profiler::get().record_execute(name, queue_time, begin_time, task_profiler::now());
+
+    return result;
+#else
+    return task->execute();
+#endif
+}
+
+task_base* task_executor::find_task(worker* worker)
+{
+    task_base* result = nullptr;
+    if (worker != nullptr && worker->queue.pop(result))
+        return result;
+
+    // Threads outside the pools help the first pool.
+    thread_pool& pool = worker != nullptr ? *worker->pool : *m_pools[0];
 
-        --task_count;
+    result = pool.queue->try_pop();
+    if (result != nullptr)
+        return result;
+
+    std::size_t worker_count = pool.workers.size();
+    if (worker_count > 1 || worker == nullptr)
+    {
+        std::size_t victim = worker != nullptr ? worker->next_victim(worker_count) : 0;
+        for (std::size_t i = 0; i < worker_count; ++i, victim = (victim + 1) % worker_count)
+        {
+            if (worker != nullptr && victim == worker->index)
+                continue;
+
+            if (pool.workers[victim]->queue.steal(result))
+            {
+#ifdef VIOLET_TASK_PROFILER
+                task_profiler::get().record_steal(
+                    result->m_name,
+                    static_cast<std::uint32_t>(victim));
+#endif
+                return result;
+            }
+        }
     }
+
+    return nullptr;
+}
+
+task_base* task_executor::wait_task(worker& worker)
+{
+    // Keep looking for a while before parking, tasks of a frame graph usually arrive in bursts.
+    for (std::size_t i = 0; i < SPIN_COUNT; ++i)
+    {
+        if (m_stop.load(std::memory_order_relaxed))
+            return nullptr;
+
+        if (task_base* result = find_task(&worker))
+            return result;
+
+        std::this_thread::yield();
+    }
+
+    thread_pool& pool = *worker.pool;
+    while (!m_stop.load())
+    {
+        std::uint32_t epoch = pool.wake_epoch.load();
+
+        // Look again after announcing the park, a task pushed before the announcement is found
+        // here and one pushed after it bumps the epoch.
+        pool.parked_count.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        task_base* result = find_task(&worker);
+        if (result == nullptr && !m_stop.load())
+            pool.wake_epoch.wait(epoch);
+        pool.parked_count.fetch_sub(1);
+
+        if (result != nullptr)
+            return result;
+    }
+
+    return nullptr;
+}
+
+task_executor::worker*& task_executor::get_current_worker() noexcept
+{
+    thread_local worker* current_worker = nullptr;
+    return current_worker;
+}
+
+void task_executor::notify_complete()
+{
+    m_wait_epoch.fetch_add(1);
+    m_wait_epoch.notify_all();
+}
+
+void task_executor::wake_worker(thread_pool& pool)
+{
+    // Pairs with the fence in wait_task, either the pushed task is seen by the parking worker or
+    // the parked worker is seen here.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pool.parked_count.load(std::memory_order_relaxed) == 0)
+        return;
+
+    pool.wake_epoch.fetch_add(1);
+    pool.wake_epoch.notify_one();
 }
 } // namespace violet
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "core/task/task_profiler.hpp"
+#include "common/dictionary.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace violet
+{
+task_profiler& task_profiler::get()
+{
+    static task_profiler instance;
+    return instance;
+}
+
+std::int64_t task_profiler::now() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void task_profiler::begin_frame()
+{
+    std::uint64_t frame = m_frame_count.load(std::memory_order_relaxed);
+    m_frames[frame % FRAME_CAPACITY].store(now(), std::memory_order_relaxed);
+    m_frame_count.store(frame + 1, std::memory_order_release);
+}
+
+void task_profiler::set_thread_name(std::string_view name)
+{
+    thread_buffer& buffer = get_thread_buffer();
+
+    std::lock_guard<std::mutex> lg(m_lock);
+    buffer.name = name;
+}
+
+void task_profiler::record_execute(
+    const char* name,
+    std::int64_t queue_time,
+    std::int64_t begin_time,
+    std::int64_t end_time)
+{
+    record({TASK_EVENT_TYPE_EXECUTE, 0, name, queue_time, begin_time, end_time});
+}
+
+void task_profiler::record_steal(const char* name, std::uint32_t victim)
+{
+    std::int64_t time = now();
+    record({TASK_EVENT_TYPE_STEAL, victim, name, time, time, time});
+}
+
+std::uint32_t task_profiler::register_thread(std::string_view name)
+{
+    thread_buffer& buffer = create_thread_buffer();
+
+    std::lock_guard<std::mutex> lg(m_lock);
+    buffer.name = name;
+    return buffer.id;
+}
+
+void task_profiler::attach_thread(std::uint32_t id)
+{
+    std::lock_guard<std::mutex> lg(m_lock);
+    get_current_buffer() = m_buffers[id].get();
+}
+
+std::string task_profiler::dump(std::size_t frame_count) const
+{
+    std::int64_t begin_time = 0;
+    std::uint64_t frame = m_frame_count.load(std::memory_order_acquire);
+    if (frame_count != 0 && frame != 0)
+    {
+        std::uint64_t count = std::min<std::uint64_t>({frame, frame_count, FRAME_CAPACITY});
+        begin_time = m_frames[(frame - count) % FRAME_CAPACITY].load(std::memory_order_relaxed);
+    }
+
+    dictionary trace_events = dictionary::array();
+
+    std::lock_guard<std::mutex> lg(m_lock);
+
+    std::vector<task_event> events;
+    for (auto& buffer : m_buffers)
+    {
+        dictionary thread_name;
+        thread_name["name"] = "thread_name";
+        thread_name["ph"] = "M";
+        thread_name["pid"] = 0;
+        thread_name["tid"] = buffer->id;
+        thread_name["args"]["name"] =
+            buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name;
+        trace_events.push_back(thread_name);
+
+        std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+        std::uint64_t tail = head - std::min<std::uint64_t>(head, EVENT_CAPACITY);
+
+        events.clear();
+        for (std::uint64_t i = tail; i < head; ++i)
+            events.push_back(buffer->events[i % EVENT_CAPACITY]);
+
+        // Events the owner wrote while copying have overwritten the oldest ones.
+        std::uint64_t new_head = buffer->head.load(std::memory_order_acquire);
+        std::uint64_t new_tail = new_head - std::min<std::uint64_t>(new_head, EVENT_CAPACITY);
+        std::size_t skip = new_tail > tail ? std::min(new_tail - tail, head - tail) : 0;
+
+        for (std::size_t i = skip; i < events.size(); ++i)
+        {
+            const task_event& event = events[i];
+            if (event.begin_time < begin_time)
+                continue;
+
+            dictionary trace_event;
+            trace_event["name"] = event.name == nullptr ? "task" : event.name;
+            trace_event["cat"] = "task";
+            trace_event["pid"] = 0;
+            trace_event["tid"] = buffer->id;
+            trace_event["ts"] = event.begin_time / 1000.0;
+
+            if (event.type == TASK_EVENT_TYPE_EXECUTE)
+            {
+                trace_event["ph"] = "X";
+                trace_event["dur"] = (event.end_time - event.begin_time) / 1000.0;
+                if (event.queue_time != 0)
+                    trace_event["args"]["wait"] = (event.begin_time - event.queue_time) / 1000.0;
+            }
+            else
+            {
+                trace_event["ph"] = "i";
+                trace_event["s"] = "t";
+                trace_event["args"]["steal from"] = event.victim;
+            }
+
+            trace_events.push_back(std::move(trace_event));
+        }
+    }
+
+    for (std::uint64_t i = frame - std::min<std::uint64_t>(frame, FRAME_CAPACITY); i < frame; ++i)
+    {
+        std::int64_t time = m_frames[i % FRAME_CAPACITY].load(std::memory_order_relaxed);
+        if (time < begin_time)
+            continue;
+
+        dictionary frame_event;
+        frame_event["name"] = "frame";
+        frame_event["ph"] = "i";
+        frame_event["s"] = "g";
+        frame_event["pid"] = 0;
+        frame_event["tid"] = 0;
+        frame_event["ts"] = time / 1000.0;
+        trace_events.push_back(std::move(frame_event));
+    }
+
+    dictionary result;
+    result["traceEvents"] = std::move(trace_events);
+    result["displayTimeUnit"] = "ns";
+    return result.dump();
+}
+
+task_profiler::thread_buffer*& task_profiler::get_current_buffer() noexcept
+{
+    // The profiler lives until the program exits, so the buffer outlives its thread.
+    thread_local thread_buffer* current_buffer = nullptr;
+    return current_buffer;
+}
+
+task_profiler::thread_buffer& task_profiler::create_thread_buffer()
+{
+    auto buffer = std::make_unique<thread_buffer>();
+    buffer->events = std::make_unique<task_event[]>(EVENT_CAPACITY);
+    buffer->head.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lg(m_lock);
+    buffer->id = static_cast<std::uint32_t>(m_buffers.size());
+    m_buffers.push_back(std::move(buffer));
+    return *m_buffers.back();
+}
+
+task_profiler::thread_buffer& task_profiler::get_thread_buffer()
+{
+    thread_buffer*& current_buffer = get_current_buffer();
+    if (current_buffer == nullptr)
+        current_buffer = &create_thread_buffer();
+    return *current_buffer;
+}
+
+void task_profiler::record(const task_event& event)
+{
+    thread_buffer& buffer = get_thread_buffer();
+
+    std::uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head % EVENT_CAPACITY] = event;
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+} // namespace violet
\ No newline at end of file
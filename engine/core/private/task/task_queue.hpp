@@ -11,39 +11,58 @@ class task_queue
 public:
     virtual ~task_queue() = default;
 
+    /**
+     * @brief Wait until a task is available.
+     *
+     * @return task_base* nullptr when the queue is closed.
+     */
     virtual task_base* pop() = 0;
+
+    /**
+     * @brief Take a task if one is available, without waiting.
+     */
+    virtual task_base* try_pop() = 0;
+
     virtual void push(task_base* task) = 0;
 
     virtual void close() = 0;
 };
 
+/**
+ * @brief Queue guarded by a mutex. Queued tasks are linked through their ready link, which is free
+ * while a task waits in a queue, so pushing does not allocate.
+ */
 class task_queue_thread_safe : public task_queue
 {
 public:
-    task_queue_thread_safe() : m_close(false) {}
+    task_queue_thread_safe() : m_head(nullptr), m_tail(nullptr), m_close(false) {}
 
     virtual void push(task_base* task) override
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        m_queue.push(task);
+        task->set_next_ready(nullptr);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_tail != nullptr)
+                m_tail->set_next_ready(task);
+            else
+                m_head = task;
+            m_tail = task;
+        }
         m_cv.notify_one();
     }
 
     virtual task_base* pop() override
     {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_cv.wait(lock, [this] { return !m_queue.empty() || m_close; });
+        m_cv.wait(lock, [this] { return m_head != nullptr || m_close; });
 
-        if (!m_queue.empty())
-        {
-            task_base* task = m_queue.front();
-            m_queue.pop();
-            return task;
-        }
-        else
-        {
-            return nullptr;
-        }
+        return pop_front();
+    }
+
+    virtual task_base* try_pop() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return pop_front();
     }
 
     virtual void close() override
@@ -53,7 +72,20 @@ public:
     }
 
 private:
-    std::queue<task_base*> m_queue;
+    task_base* pop_front() noexcept
+    {
+        task_base* task = m_head;
+        if (task != nullptr)
+        {
+            m_head = task->get_next_ready();
+            if (m_head == nullptr)
+                m_tail = nullptr;
+        }
+        return task;
+    }
+
+    task_base* m_head;
+    task_base* m_tail;
 
     std::condition_variable m_cv;
     std::mutex m_mutex;
@@ -82,6 +114,12 @@ public:
         return task;
     }
 
+    virtual task_base* try_pop() override
+    {
+        task_base* task = nullptr;
+        return m_queue.pop(task) ? task : nullptr;
+    }
+
     virtual void close() override { m_close = true; }
 
 private:
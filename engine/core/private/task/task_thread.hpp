@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace violet
+{
+/**
+ * @brief Name the calling thread, so it can be told apart in debuggers and profilers.
+ */
+void set_thread_name(std::string_view name);
+
+/**
+ * @brief Number of processors of a NUMA node.
+ *
+ * @param numa_node The node, -1 for every processor of the machine.
+ */
+std::size_t get_processor_count(int numa_node);
+
+/**
+ * @brief Restrict the calling thread to the processors of a NUMA node, or to one of them.
+ *
+ * @param numa_node The node, -1 for every processor of the machine.
+ * @param processor Index of the processor within the node, -1 to run on any of them.
+ * @return Whether the affinity was changed.
+ */
+bool set_thread_affinity(int numa_node, int processor);
+} // namespace violet
\ No newline at end of file
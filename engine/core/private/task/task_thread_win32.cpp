@@ -0,0 +1,83 @@
+#include "task/task_thread.hpp"
+#include <Windows.h>
+#include <bit>
+#include <cstdint>
+#include <string>
+
+namespace violet
+{
+namespace
+{
+bool get_numa_node_affinity(int numa_node, GROUP_AFFINITY& affinity)
+{
+    ULONG highest_node = 0;
+    if (!GetNumaHighestNodeNumber(&highest_node) || static_cast<ULONG>(numa_node) > highest_node)
+        return false;
+
+    // Only the primary group of a node spanning several processor groups is returned.
+    return GetNumaNodeProcessorMaskEx(static_cast<USHORT>(numa_node), &affinity) &&
+           affinity.Mask != 0;
+}
+} // namespace
+
+void set_thread_name(std::string_view name)
+{
+    std::wstring wide_name(name.begin(), name.end());
+    SetThreadDescription(GetCurrentThread(), wide_name.c_str());
+}
+
+std::size_t get_processor_count(int numa_node)
+{
+    if (numa_node < 0)
+        return GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+
+    GROUP_AFFINITY affinity = {};
+    if (!get_numa_node_affinity(numa_node, affinity))
+        return 0;
+
+    return std::popcount(static_cast<std::uint64_t>(affinity.Mask));
+}
+
+bool set_thread_affinity(int numa_node, int processor)
+{
+    GROUP_AFFINITY affinity = {};
+
+    if (numa_node >= 0)
+    {
+        if (!get_numa_node_affinity(numa_node, affinity))
+            return false;
+
+        if (processor >= 0)
+        {
+            // Clear the lowest bits until the processor is the lowest one left.
+            int count = std::popcount(static_cast<std::uint64_t>(affinity.Mask));
+            KAFFINITY mask = affinity.Mask;
+            for (int i = 0; i < processor % count; ++i)
+                mask &= mask - 1;
+            affinity.Mask = mask & (~mask + 1);
+        }
+    }
+    else
+    {
+        if (processor < 0)
+            return false;
+
+        // Machines with more than 64 processors split them into groups.
+        DWORD index = static_cast<DWORD>(processor) % GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        WORD group_count = GetActiveProcessorGroupCount();
+        for (WORD group = 0; group < group_count; ++group)
+        {
+            DWORD count = GetActiveProcessorCount(group);
+            if (index < count)
+            {
+                affinity.Group = group;
+                affinity.Mask = static_cast<KAFFINITY>(1) << index;
+                break;
+            }
+            index -= count;
+        }
+    }
+
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+} // namespace violet
\ No newline at end of file
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace violet
+{
+/**
+ * @brief Chase-Lev work stealing deque.
+ *
+ * The owner thread pushes and pops at the bottom, so it runs its own work in LIFO order while the
+ * data is still in cache. Other threads steal from the top. The buffer grows when it is full, old
+ * buffers are kept until the queue is destroyed because thieves may still read from them.
+ *
+ * @tparam T A trivially copyable type, usually a pointer.
+ */
+template <typename T>
+class work_stealing_queue
+{
+public:
+    using value_type = T;
+
+public:
+    work_stealing_queue(std::int64_t capacity = 256) : m_top(0), m_bottom(0)
+    {
+        m_buffers.push_back(std::make_unique<buffer>(capacity));
+        m_buffer.store(m_buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Push a value at the bottom. Only called by the owner thread.
+     */
+    void push(const value_type& value)
+    {
+        std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        std::int64_t top = m_top.load(std::memory_order_acquire);
+        buffer* current = m_buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top > current->capacity - 1)
+        {
+            m_buffers.push_back(current->grow(bottom, top));
+            current = m_buffers.back().get();
+            m_buffer.store(current, std::memory_order_release);
+        }
+
+        current->store(bottom, value);
+        m_bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Pop the value pushed last. Only called by the owner thread.
+     *
+     * @return bool False if the queue is empty or the last value was stolen.
+     */
+    bool pop(value_type& value)
+    {
+        std::int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        buffer* current = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        value = current->load(bottom);
+        if (top == bottom)
+        {
+            // Last value, race against thieves for it.
+            bool success = m_top.compare_exchange_strong(
+                top,
+                top + 1,
+                std::memory_order_seq_cst,
+                std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return success;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest value. Can be called by any thread.
+     *
+     * @return bool False if the queue is empty or another thread took the value first.
+     */
+    bool steal(value_type& value)
+    {
+        std::int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+            return false;
+
+        value = m_buffer.load(std::memory_order_acquire)->load(top);
+        return m_top.compare_exchange_strong(
+            top,
+            top + 1,
+            std::memory_order_seq_cst,
+            std::memory_order_relaxed);
+    }
+
+    bool empty() const noexcept
+    {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct buffer
+    {
+        buffer(std::int64_t capacity)
+            : capacity(capacity),
+              data(std::make_unique<std::atomic<value_type>[]>(capacity))
+        {
+        }
+
+        value_type load(std::int64_t index) const noexcept
+        {
+            return data[index & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void store(std::int64_t index, const value_type& value) noexcept
+        {
+            data[index & (capacity - 1)].store(value, std::memory_order_relaxed);
+        }
+
+        std::unique_ptr<buffer> grow(std::int64_t bottom, std::int64_t top) const
+        {
+            auto result = std::make_unique<buffer>(capacity * 2);
+            for (std::int64_t i = top; i < bottom; ++i)
+                result->store(i, load(i));
+            return result;
+        }
+
+        // Always a power of two.
+        std::int64_t capacity;
+        std::unique_ptr<std::atomic<value_type>[]> data;
+    };
+
+    alignas(64) std::atomic<std::int64_t> m_top;
+    alignas(64) std::atomic<std::int64_t> m_bottom;
+    std::atomic<buffer*> m_buffer;
+
+    // Only touched by the owner thread.
+    std::vector<std::unique_ptr<buffer>> m_buffers;
+};
+} // namespace violet
@@ -2,6 +2,7 @@
 
 #include "core/ecs/world.hpp"
 #include <string_view>
+#include <vector>
 
 namespace violet
 {
@@ -15,13 +16,25 @@ public:
         component_handle(actor* owner = nullptr) : m_owner(owner) {}
 
         actor* get_owner() const noexcept { return m_owner; }
+
+        /**
+         * @brief Get the component for writing, the chunk is stamped as changed.
+         */
         T* get() const noexcept
         {
-            return &m_owner->get_world().get_component<T>(m_owner->m_entity);
+            return &m_owner->get_world().get_component<T>(m_owner->m_entity, m_cache);
+        }
+
+        /**
+         * @brief Get the component for reading, the chunk is not stamped.
+         */
+        const T* read() const noexcept
+        {
+            return &m_owner->get_world().get_component<const T>(m_owner->m_entity, m_cache);
         }
 
         T* operator->() const { return get(); }
-        T& operator*() const { return m_owner->get_world().get_component<T>(m_owner->m_entity); }
+        T& operator*() const { return *get(); }
 
         operator T*() const { return get(); }
 
@@ -36,6 +49,10 @@ public:
 
     private:
         actor* m_owner;
+
+        // The pointer is refreshed only when the entity moves, so following handles in a hierarchy
+        // does not look up the entity every time.
+        mutable world::component_cache m_cache;
     };
 
 public:
@@ -43,6 +60,28 @@ public:
     actor(const actor&) = delete;
     ~actor();
 
+    /**
+     * @brief Create an actor for each name. The entities of all actors are created in one batch,
+     * together with the components.
+     */
+    template <typename... Components, typename Names>
+    static std::vector<std::unique_ptr<actor>> create_batch(const Names& names, world& world)
+    {
+        std::vector<std::unique_ptr<actor>> result;
+        std::vector<actor*> owners;
+        for (const auto& name : names)
+        {
+            result.push_back(std::unique_ptr<actor>(new actor(name, world, entity{})));
+            owners.push_back(result.back().get());
+        }
+
+        std::vector<entity> entities = world.create_batch<Components...>(owners);
+        for (std::size_t i = 0; i < entities.size(); ++i)
+            result[i]->m_entity = entities[i];
+
+        return result;
+    }
+
     template <typename Component>
     [[nodiscard]] component_handle<Component> get()
     {
@@ -52,31 +91,47 @@ public:
     template <typename... Components>
     auto add()
     {
-        m_world.add_component<Components...>(m_entity);
+        m_world->add_component<Components...>(m_entity);
         return std::make_tuple(get<Components>()...);
     }
 
     template <typename... Components>
     void remove()
     {
-        m_world.remove_component<Components...>(m_entity);
+        m_world->remove_component<Components...>(m_entity);
+    }
+
+    template <typename Component>
+    void set_shared(const Component& value)
+    {
+        m_world->set_shared_component(m_entity, value);
+    }
+
+    template <typename Component>
+    [[nodiscard]] const Component& get_shared()
+    {
+        return m_world->get_shared_component<Component>(m_entity);
     }
 
     template <typename Component>
     [[nodiscard]] bool has()
     {
-        return m_world.has_component<Component>(m_entity);
+        return m_world->has_component<Component>(m_entity);
     }
 
     [[nodiscard]] const std::string& get_name() const noexcept { return m_name; }
-    [[nodiscard]] world& get_world() const { return m_world; }
+    [[nodiscard]] world& get_world() const { return *m_world; }
 
     actor& operator=(const actor&) = delete;
 
 private:
+    friend class world;
+
+    actor(std::string_view name, world& world, entity entity) noexcept;
+
     std::string m_name;
     entity m_entity;
-    world& m_world;
+    world* m_world;
 };
 
 template <typename T>
@@ -3,14 +3,26 @@
 #include "core/ecs/component.hpp"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 namespace violet
 {
-class archetype_chunk;
+class actor;
+struct archetype_chunk;
 class archetype_chunk_allocator;
 
+static constexpr std::size_t DEFAULT_CHUNK_SIZE = 1024 * 16;
+
+/**
+ * @brief Values of shared components, ordered by component id. Shared components without a value
+ * are left out.
+ */
+using shared_component_list = std::vector<std::pair<component_id, const void*>>;
+
 template <typename Archetype>
 class archetype_iterator
 {
@@ -33,6 +45,11 @@ public:
             static_cast<const long>(m_offset),
             static_cast<const long>(m_archetype->m_entity_per_chunk));
 
+        if constexpr (std::is_empty_v<Component>)
+        {
+            return *reinterpret_cast<Component*>(m_archetype->m_tag_storage.data());
+        }
+
         std::size_t id = component_index::value<Component>();
         std::size_t address =
             m_archetype->m_offset[id] + entity_index * m_archetype->m_component_table[id]->size();
@@ -85,17 +102,97 @@ public:
     archetype(
         const std::vector<component_id>& components,
         const component_table& component_table,
-        archetype_chunk_allocator* allocator) noexcept;
+        archetype_chunk_allocator* allocator,
+        const std::atomic<std::uint32_t>& change_version) noexcept;
 
     virtual ~archetype();
 
+    /**
+     * @brief Add an entity without shared component values.
+     *
+     * @return std::size_t Index of the entity, which is chunk index * entity_per_chunk() + the
+     * position in the chunk.
+     */
     std::size_t add();
+
+    /**
+     * @brief Add an entity for each owner, without shared component values. Chunks are allocated
+     * up front and components are constructed column by column.
+     *
+     * @param owners The owner of each entity, which will be written to the actor* component.
+     * @param indices Receives the index of each added entity.
+     */
+    void add(std::span<actor* const> owners, std::span<std::size_t> indices);
+
+    /**
+     * @brief Move an entity to the target archetype, keeping the values of the shared components
+     * the target also has.
+     *
+     * @return std::size_t Index of the entity in the target archetype.
+     */
     std::size_t move(std::size_t index, archetype& target);
+
+    /**
+     * @brief Move an entity to the chunks of the target archetype that have the shared component
+     * values. The target may be this archetype, to change the values of the entity.
+     */
+    std::size_t move(
+        std::size_t index,
+        archetype& target,
+        const shared_component_list& shared_components);
+
+    /**
+     * @brief Move count entities of a chunk, starting at the index, to the target archetype and
+     * keep their shared component values. Columns of trivially copyable components are copied in
+     * bulk.
+     *
+     * @param indices Receives the index of each moved entity in the target archetype.
+     */
+    void move(
+        std::size_t index,
+        std::size_t count,
+        archetype& target,
+        std::span<std::size_t> indices);
+
     void remove(std::size_t index);
+
+    /**
+     * @brief Remove count entities of a chunk, starting at the index. The gap is filled with the
+     * entities at the back of the chunks with the same shared component values, which are moved
+     * into the removed range.
+     */
+    void remove(std::size_t index, std::size_t count);
+
+    /**
+     * @brief Move all entities of an archetype with the same components to this one, usually from
+     * another world sharing the component table. When both use the same chunk size, only the
+     * entities needed to fill the last chunk of each group of shared component values are copied
+     * and the other chunks of the source are taken over as they are. Entities do not keep their
+     * order.
+     *
+     * @param indices Receives the index of each moved entity.
+     */
+    void merge(archetype& source, std::vector<std::size_t>& indices);
+
+    /**
+     * @brief Exchange the components of two entities with the same shared component values, which
+     * may be in different chunks.
+     */
+    void swap(std::size_t a, std::size_t b);
+
     void clear() noexcept;
 
     [[nodiscard]] iterator begin() { return iterator(this, 0); }
-    [[nodiscard]] iterator end() { return iterator(this, size()); }
+
+    /**
+     * @brief Whether an entity is stored at the index.
+     */
+    [[nodiscard]] bool contains(std::size_t index) const noexcept
+    {
+        std::size_t chunk_index = index / m_entity_per_chunk;
+        return chunk_index < m_chunks.size() &&
+               index % m_entity_per_chunk < m_chunk_sizes[chunk_index];
+    }
 
     [[nodiscard]] inline std::size_t size() const noexcept { return m_size; }
     [[nodiscard]] inline std::size_t entity_per_chunk() const noexcept
@@ -103,30 +200,290 @@ public:
         return m_entity_per_chunk;
     }
 
+    /**
+     * @brief Get the number of chunk slots. Chunks of different shared component values are
+     * filled separately, so chunks may be partially filled, and slots of released chunks have a
+     * size of 0 until they are reused.
+     */
+    [[nodiscard]] inline std::size_t get_chunk_count() const noexcept { return m_chunks.size(); }
+    [[nodiscard]] inline archetype_chunk_allocator* get_chunk_allocator() const noexcept
+    {
+        return m_chunk_allocator;
+    }
+    [[nodiscard]] inline std::size_t get_chunk_size(std::size_t chunk_index) const noexcept
+    {
+        assert(chunk_index < m_chunks.size());
+        return m_chunk_sizes[chunk_index];
+    }
+
+    /**
+     * @brief Get the number of groups of chunks. Entities with the same shared component values
+     * are kept in the chunks of one group, which are full except the last one. Unused groups have
+     * no chunks.
+     */
+    [[nodiscard]] std::size_t get_group_count() const noexcept { return m_groups.size(); }
+    [[nodiscard]] const std::vector<std::size_t>& get_group_chunks(
+        std::size_t group) const noexcept
+    {
+        return m_groups[group].chunks;
+    }
+
+    /**
+     * @brief Get the first element of a component column in the chunk. Components of the same type
+     * are stored contiguously, so the next get_chunk_size(chunk_index) elements are valid.
+     */
+    template <typename Component>
+    [[nodiscard]] Component* get_component_array(std::size_t chunk_index)
+    {
+        std::size_t id = component_index::value<std::remove_const_t<Component>>();
+        assert(m_mask.test(id) && !m_component_table[id]->is_shared());
+
+        // Tags have no state, all chunks use the same placeholder array.
+        if constexpr (std::is_empty_v<Component>)
+            return reinterpret_cast<Component*>(m_tag_storage.data());
+        else
+            return static_cast<Component*>(get_data_pointer(chunk_index, m_offset[id]));
+    }
+
+    /**
+     * @brief Get the first element of a component column in the chunk by component id.
+     */
+    [[nodiscard]] void* get_component_array(std::size_t chunk_index, component_id component)
+    {
+        assert(m_mask.test(component) && m_component_table[component]->has_storage());
+        return get_data_pointer(chunk_index, m_offset[component]);
+    }
+
+    /**
+     * @brief Get the version at which the component column of the chunk was last written.
+     */
+    [[nodiscard]] std::uint32_t get_chunk_version(
+        std::size_t chunk_index,
+        component_id component) const noexcept
+    {
+        std::size_t index = chunk_index * m_components.size() + get_component_slot(component);
+        return std::atomic_ref<std::uint32_t>(const_cast<std::uint32_t&>(m_chunk_versions[index]))
+            .load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stamp the component column of the chunk with the current change version of the world.
+     * Tasks of a parallel view may stamp the same chunk concurrently.
+     */
+    void mark_changed(std::size_t chunk_index, component_id component) noexcept
+    {
+        mark_changed_at(get_chunk_version_index(chunk_index, component));
+    }
+
+    /**
+     * @brief Get the position of the version of a component column of the chunk. It stays valid
+     * while the chunk is in use, so writes can be stamped without looking up the column again.
+     */
+    [[nodiscard]] std::size_t get_chunk_version_index(
+        std::size_t chunk_index,
+        component_id component) const noexcept
+    {
+        return chunk_index * m_components.size() + get_component_slot(component);
+    }
+
+    /**
+     * @brief Stamp a version returned by get_chunk_version_index with the current change version.
+     */
+    void mark_changed_at(std::size_t version_index) noexcept
+    {
+        std::atomic_ref<std::uint32_t>(m_chunk_versions[version_index])
+            .store(m_change_version.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stamp all component columns of the chunk, used when entities of the chunk are added,
+     * moved or removed.
+     */
+    void mark_changed(std::size_t chunk_index) noexcept;
+
+    /**
+     * @brief Get the change version at which world::defragment last found the entities in key
+     * order. Chunks stamped after it may be out of order.
+     */
+    [[nodiscard]] std::uint32_t get_ordered_version() const noexcept { return m_ordered_version; }
+    void set_ordered_version(std::uint32_t version) noexcept { m_ordered_version = version; }
+
+    /**
+     * @brief Get the address of a component of the entity at the index.
+     */
+    [[nodiscard]] void* get_component(std::size_t index, component_id component);
+
     [[nodiscard]] inline const std::vector<component_id>& get_components() const noexcept
     {
         return m_components;
     }
     [[nodiscard]] inline const component_mask& get_mask() const noexcept { return m_mask; }
 
+    /**
+     * @brief Get the shared component values of the entities of the chunk.
+     */
+    [[nodiscard]] const shared_component_list& get_shared_components(
+        std::size_t chunk_index) const noexcept
+    {
+        return m_groups[m_chunk_groups[chunk_index]].values;
+    }
+
+    /**
+     * @brief Get the value of a shared component, which is the same for all entities of the chunk.
+     */
+    template <typename Component>
+    [[nodiscard]] const Component* get_shared_component(std::size_t chunk_index) const noexcept
+    {
+        component_id id = component_index::value<Component>();
+        for (auto& [shared_id, value] : get_shared_components(chunk_index))
+        {
+            if (shared_id == id)
+                return static_cast<const Component*>(value);
+        }
+        return nullptr;
+    }
+
+    [[nodiscard]] archetype* get_add_edge(component_id component) const noexcept
+    {
+        auto iter = find_edge(component);
+        return iter == m_edges.end() || iter->first != component ? nullptr : iter->second.add;
+    }
+
+    [[nodiscard]] archetype* get_remove_edge(component_id component) const noexcept
+    {
+        auto iter = find_edge(component);
+        return iter == m_edges.end() || iter->first != component ? nullptr : iter->second.remove;
+    }
+
+    void set_add_edge(component_id component, archetype* target)
+    {
+        get_edge(component).add = target;
+    }
+
+    void set_remove_edge(component_id component, archetype* target)
+    {
+        get_edge(component).remove = target;
+    }
+
 private:
+    /**
+     * @brief Archetypes reached by adding or removing a component.
+     */
+    struct archetype_edge
+    {
+        archetype* add{nullptr};
+        archetype* remove{nullptr};
+    };
+
+    using edge_list = std::vector<std::pair<component_id, archetype_edge>>;
+
+    [[nodiscard]] edge_list::const_iterator find_edge(component_id component) const noexcept
+    {
+        return std::lower_bound(
+            m_edges.begin(),
+            m_edges.end(),
+            component,
+            [](const auto& edge, component_id id)
+            {
+                return edge.first < id;
+            });
+    }
+
+    archetype_edge& get_edge(component_id component)
+    {
+        auto iter = m_edges.begin() + (find_edge(component) - m_edges.cbegin());
+        if (iter == m_edges.end() || iter->first != component)
+            iter = m_edges.insert(iter, {component, archetype_edge{}});
+        return iter->second;
+    }
+
+    /**
+     * @brief Chunks of the entities with the same shared component values.
+     */
+    struct chunk_group
+    {
+        shared_component_list values;
+        std::vector<std::size_t> chunks;
+    };
+
+    struct shared_component_list_hash
+    {
+        std::size_t operator()(const shared_component_list& list) const noexcept
+        {
+            std::size_t result = 0;
+            for (auto& [id, value] : list)
+            {
+                result ^=
+                    std::hash<const void*>()(value) + 0x9e3779b9 + (result << 6) + (result >> 2);
+            }
+            return result;
+        }
+    };
+
     friend class iterator;
 
     void initialize_layout(const std::vector<component_id>& components);
 
-    std::size_t allocate();
-    void construct(std::size_t index);
-    void move_construct(std::size_t source, std::size_t target);
-    void destruct(std::size_t index);
+    /**
+     * @brief Get the group of the shared component values, the group is created and references
+     * the values until its last chunk is released.
+     */
+    std::size_t get_group(const shared_component_list& shared_components);
+    void release_group(std::size_t group) noexcept;
+
+    /**
+     * @brief Allocate up to count entities in the last chunk of the group, a new chunk is added
+     * when it is full.
+     *
+     * @return std::pair<std::size_t, std::size_t> Index of the first entity and the number of
+     * allocated entities.
+     */
+    std::pair<std::size_t, std::size_t> allocate(std::size_t group, std::size_t count);
 
-    [[nodiscard]] std::size_t capacity() const noexcept
+    /**
+     * @brief Add a chunk to the end of the group, reusing a released chunk slot if there is one.
+     */
+    std::size_t attach_chunk(std::size_t group, archetype_chunk* chunk);
+
+    /**
+     * @brief Remove the last chunk of a group, which must be empty.
+     */
+    archetype_chunk* detach_chunk(std::size_t chunk_index) noexcept;
+
+    [[nodiscard]] std::size_t get_component_slot(component_id component) const noexcept
     {
-        return m_entity_per_chunk * m_chunks.size();
+        auto iter = std::find(m_components.begin(), m_components.end(), component);
+        assert(iter != m_components.end());
+        return iter - m_components.begin();
     }
+    void construct(std::size_t index);
+
+    /**
+     * @brief Destroy count entities of a chunk, starting at the index.
+     */
+    void destruct(std::size_t index, std::size_t count);
+
+    /**
+     * @brief Move construct the components of count entities of a chunk into a chunk of the
+     * target, which may be this archetype. Components the target does not have are skipped, the
+     * source components are left to be destroyed.
+     */
+    void move_construct(
+        archetype& target,
+        std::size_t source_index,
+        std::size_t target_index,
+        std::size_t count);
+
+    /**
+     * @brief Move count entities of a chunk to free slots of a chunk of this archetype.
+     */
+    void relocate(std::size_t source_index, std::size_t target_index, std::size_t count);
 
     void* get_data_pointer(std::size_t chunk_index, std::size_t offset);
 
     std::vector<component_id> m_components;
+    // Components that have a column in the chunks, tags and shared components are excluded.
+    std::vector<component_id> m_columns;
     const component_table& m_component_table;
 
     component_mask m_mask;
@@ -135,8 +492,34 @@ private:
 
     std::size_t m_entity_per_chunk;
     archetype_chunk_allocator* m_chunk_allocator;
+    // Chunks indexed by chunk index, null for released slots that are kept for reuse.
     std::vector<archetype_chunk*> m_chunks;
+    std::vector<std::size_t> m_chunk_sizes;
+    std::vector<std::size_t> m_chunk_groups;
+    std::vector<std::size_t> m_free_chunks;
+
+    std::vector<chunk_group> m_groups;
+    std::vector<std::size_t> m_free_groups;
+    std::unordered_map<shared_component_list, std::size_t, shared_component_list_hash>
+        m_group_indices;
+
+    // Change version of each component column, indexed by chunk * component count + slot. Stamps
+    // are atomic, tasks of parallel views stamp shared chunks. The vector itself only changes on
+    // structural changes, which never run concurrently with views.
+    std::vector<std::uint32_t> m_chunk_versions;
+    const std::atomic<std::uint32_t>& m_change_version;
+    std::uint32_t m_ordered_version;
+
+    std::array<std::uint32_t, MAX_COMPONENT> m_offset;
+
+    // Placeholder array returned for tag components.
+    std::vector<std::uint8_t> m_tag_storage;
+
+    // Temporary storage for swapping components that are not trivially copyable.
+    std::vector<std::uint8_t> m_swap_buffer;
 
-    std::array<std::uint16_t, MAX_COMPONENT> m_offset;
+    // Sorted by component id. An archetype has few edges, a binary search over a contiguous array
+    // is cheaper than hashing on every structural change.
+    edge_list m_edges;
 };
 } // namespace violet
\ No newline at end of file
@@ -2,8 +2,16 @@
 
 #include "common/type_index.hpp"
 #include <bitset>
+#include <cassert>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
 namespace violet
 {
@@ -15,13 +23,49 @@ struct component_index : public type_index<component_index, component_id>
 
 class actor;
 
+enum component_flag
+{
+    // move_construct is replaced by memcpy over whole column ranges.
+    COMPONENT_FLAG_TRIVIALLY_COPYABLE = 1 << 0,
+    // destruct is not called.
+    COMPONENT_FLAG_TRIVIALLY_DESTRUCTIBLE = 1 << 1,
+    // Empty component that only exists in the component mask, no storage is allocated.
+    COMPONENT_FLAG_TAG = 1 << 2,
+    // Component whose value is stored once per chunk, see shared_component_info.
+    COMPONENT_FLAG_SHARED = 1 << 3
+};
+using component_flags = std::uint32_t;
+
+/**
+ * @brief Hash of the type name, which identifies a component across worlds and snapshots of the
+ * same build, unlike component_id which depends on the order of first use.
+ */
+template <typename Component>
+std::uint64_t get_component_type_hash() noexcept
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const char* c = typeid(Component).name(); *c != '\0'; ++c)
+    {
+        hash ^= static_cast<unsigned char>(*c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 class component_info
 {
 public:
-    component_info(std::size_t size, std::size_t align, component_id id) noexcept
+    component_info(
+        std::size_t size,
+        std::size_t align,
+        component_id id,
+        component_flags flags = 0,
+        std::uint64_t type_hash = 0) noexcept
         : m_size(size),
           m_align(align),
-          m_id(id)
+          m_id(id),
+          m_flags(flags),
+          m_type_hash(type_hash)
     {
     }
     virtual ~component_info() = default;
@@ -30,16 +74,85 @@ public:
     virtual void move_construct(actor* owner, void* source, void* target) = 0;
     virtual void destruct(void* target) = 0;
 
+    /**
+     * @brief Append the component to a world snapshot. Trivially copyable components are written
+     * as raw memory and do not call this.
+     *
+     * @return bool False when the component can not be serialized, it is then default constructed
+     * when the snapshot is loaded.
+     */
+    virtual bool serialize(
+        [[maybe_unused]] const void* source,
+        [[maybe_unused]] std::vector<std::uint8_t>& output)
+    {
+        return false;
+    }
+
+    /**
+     * @brief Read a component written by serialize into a constructed component.
+     *
+     * @param source The rest of the column, which may be corrupt. Reading must stay within it.
+     * @return std::size_t The number of bytes read, 0 if the source is invalid.
+     */
+    virtual std::size_t deserialize(
+        [[maybe_unused]] std::span<const std::uint8_t> source,
+        [[maybe_unused]] void* target)
+    {
+        return 0;
+    }
+
+    /**
+     * @brief Add a reference to a value of a shared component, see shared_component_info.
+     *
+     * @param value A value equal to the one being referenced.
+     * @return const void* The stored value, which stays valid until its last reference is
+     * released.
+     */
+    virtual const void* acquire_shared_value([[maybe_unused]] const void* value)
+    {
+        return nullptr;
+    }
+
+    /**
+     * @brief Release a reference added by acquire_shared_value.
+     */
+    virtual void release_shared_value([[maybe_unused]] const void* value) {}
+
     std::size_t size() const noexcept { return m_size; }
     std::size_t align() const noexcept { return m_align; }
 
     component_id get_id() const noexcept { return m_id; }
 
+    component_flags get_flags() const noexcept { return m_flags; }
+    std::uint64_t get_type_hash() const noexcept { return m_type_hash; }
+
+    bool is_trivially_copyable() const noexcept
+    {
+        return m_flags & COMPONENT_FLAG_TRIVIALLY_COPYABLE;
+    }
+    bool is_trivially_destructible() const noexcept
+    {
+        return m_flags & COMPONENT_FLAG_TRIVIALLY_DESTRUCTIBLE;
+    }
+    bool is_tag() const noexcept { return m_flags & COMPONENT_FLAG_TAG; }
+    bool is_shared() const noexcept { return m_flags & COMPONENT_FLAG_SHARED; }
+
+    /**
+     * @brief Whether the component takes a column in the chunks of archetypes.
+     */
+    bool has_storage() const noexcept
+    {
+        return !(m_flags & (COMPONENT_FLAG_TAG | COMPONENT_FLAG_SHARED));
+    }
+
 private:
     std::size_t m_size;
     std::size_t m_align;
 
     component_id m_id;
+
+    component_flags m_flags;
+    std::uint64_t m_type_hash;
 };
 
 template <typename Component>
@@ -47,7 +160,16 @@ class component_info_default : public component_info
 {
 public:
     component_info_default()
-        : component_info(sizeof(Component), alignof(Component), component_index::value<Component>())
+        : component_info(
+              sizeof(Component),
+              alignof(Component),
+              component_index::value<Component>(),
+              (std::is_trivially_copyable_v<Component> ? COMPONENT_FLAG_TRIVIALLY_COPYABLE : 0) |
+                  (std::is_trivially_destructible_v<Component>
+                       ? COMPONENT_FLAG_TRIVIALLY_DESTRUCTIBLE
+                       : 0) |
+                  (std::is_empty_v<Component> ? COMPONENT_FLAG_TAG : 0),
+              get_component_type_hash<Component>())
     {
     }
 
@@ -65,6 +187,93 @@ public:
     virtual void destruct(void* target) override { static_cast<Component*>(target)->~Component(); }
 };
 
+/**
+ * @brief Default hash of shared component values. Types without a std::hash specialization are
+ * hashed by their bytes, so every byte of the value must take part in operator==.
+ */
+template <typename Component>
+struct shared_component_hash
+{
+    std::size_t operator()(const Component& value) const noexcept
+    {
+        if constexpr (requires { std::hash<Component>()(value); })
+        {
+            return std::hash<Component>()(value);
+        }
+        else
+        {
+            static_assert(
+                std::has_unique_object_representations_v<Component>,
+                "Shared components with padding need a hash.");
+
+            std::size_t hash = 14695981039346656037ull;
+            const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+            for (std::size_t i = 0; i < sizeof(Component); ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+    }
+};
+
+/**
+ * @brief Info of a shared component. Entities with the same value of a shared component are grouped
+ * in the same chunks, and the value is stored once in this info instead of per entity. Values are
+ * looked up by Hash and operator==, and released when no chunk uses them any more.
+ */
+template <typename Component, typename Hash = shared_component_hash<Component>>
+class shared_component_info : public component_info
+{
+public:
+    shared_component_info()
+        : component_info(
+              sizeof(Component),
+              alignof(Component),
+              component_index::value<Component>(),
+              COMPONENT_FLAG_SHARED,
+              get_component_type_hash<Component>())
+    {
+    }
+
+    // Shared components have no storage in chunks, so there is nothing to construct.
+    virtual void construct(actor*, void*) override {}
+    virtual void move_construct(actor*, void*, void*) override {}
+    virtual void destruct(void*) override {}
+
+    virtual const void* acquire_shared_value(const void* value) override
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto [iter, inserted] = m_values.try_emplace(*static_cast<const Component*>(value), 0);
+        ++iter->second;
+        return &iter->first;
+    }
+
+    virtual void release_shared_value(const void* value) override
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        auto iter = m_values.find(*static_cast<const Component*>(value));
+        assert(iter != m_values.end() && iter->second != 0);
+        if (--iter->second == 0)
+            m_values.erase(iter);
+    }
+
+    /**
+     * @brief Get the number of distinct values in use.
+     */
+    std::size_t get_value_count() const noexcept { return m_values.size(); }
+
+private:
+    // Reference count of each value. Nodes never move, so values are referenced by address.
+    std::unordered_map<Component, std::size_t, Hash> m_values;
+
+    // Worlds sharing the component table may change shared components at the same time.
+    std::mutex m_lock;
+};
+
 static constexpr std::size_t MAX_COMPONENT = 512;
 using component_mask = std::bitset<MAX_COMPONENT>;
 
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "core/ecs/component.hpp"
+#include "core/ecs/entity.hpp"
+#include <cassert>
+#include <new>
+#include <vector>
+
+namespace violet
+{
+enum entity_command_type : std::uint8_t
+{
+    ENTITY_COMMAND_TYPE_CREATE,
+    ENTITY_COMMAND_TYPE_RELEASE,
+    ENTITY_COMMAND_TYPE_ADD,
+    ENTITY_COMMAND_TYPE_REMOVE
+};
+
+class world;
+
+/**
+ * @brief Records structural changes of the world, which are applied later by world::playback at a
+ * sync point. Recording only reserves entities in the world, so it is safe while views are
+ * iterating or on worker threads. A buffer itself is not thread-safe, each thread should record
+ * into its own buffer, see world::get_command_buffer.
+ */
+class entity_command_buffer
+{
+public:
+    entity_command_buffer(world& world) noexcept;
+    entity_command_buffer(const entity_command_buffer&) = delete;
+    ~entity_command_buffer();
+
+    /**
+     * @brief Create an entity with the components. The components are constructed by the
+     * component_info and then assigned with the values.
+     *
+     * @return entity A reserved entity, which can be used in later commands of the buffer and
+     * becomes valid to access after the playback.
+     */
+    template <typename... Components>
+    entity create(actor* owner, Components... values)
+    {
+        command& command = add_command(ENTITY_COMMAND_TYPE_CREATE, reserve_entity());
+        command.owner = owner;
+        (record_value(command, std::move(values)), ...);
+        return command.target;
+    }
+
+    void release(entity entity) { add_command(ENTITY_COMMAND_TYPE_RELEASE, entity); }
+
+    /**
+     * @brief Add components constructed by the component_info.
+     */
+    template <typename... Components>
+    void add_component(entity entity)
+    {
+        command& command = add_command(ENTITY_COMMAND_TYPE_ADD, entity);
+        (command.mask.set(component_index::value<Components>()), ...);
+    }
+
+    /**
+     * @brief Add components and assign them with the values.
+     */
+    template <typename... Components>
+    void add_component(entity entity, Components... values)
+    {
+        command& command = add_command(ENTITY_COMMAND_TYPE_ADD, entity);
+        (record_value(command, std::move(values)), ...);
+    }
+
+    template <typename... Components>
+    void remove_component(entity entity)
+    {
+        command& command = add_command(ENTITY_COMMAND_TYPE_REMOVE, entity);
+        (command.mask.set(component_index::value<Components>()), ...);
+    }
+
+    void clear();
+
+    [[nodiscard]] bool empty() const noexcept { return m_commands.empty(); }
+
+    entity_command_buffer& operator=(const entity_command_buffer&) = delete;
+
+private:
+    friend class world;
+
+    struct component_value
+    {
+        component_id id;
+        void* data;
+
+        void (*assign)(void* target, void* source);
+        void (*destruct)(void* value);
+    };
+
+    struct command
+    {
+        entity_command_type type;
+        entity target;
+        actor* owner;
+
+        component_mask mask;
+
+        std::size_t value_offset;
+        std::size_t value_count;
+    };
+
+    command& add_command(entity_command_type type, entity entity)
+    {
+        command& result = m_commands.emplace_back();
+        result.type = type;
+        result.target = entity;
+        result.owner = nullptr;
+        result.value_offset = m_values.size();
+        result.value_count = 0;
+        return result;
+    }
+
+    template <typename Component>
+    void record_value(command& command, Component&& value)
+    {
+        using value_type = std::decay_t<Component>;
+
+        component_value result = {};
+        result.id = component_index::value<value_type>();
+        result.data = new (allocate(sizeof(value_type), alignof(value_type)))
+            value_type(std::forward<Component>(value));
+        result.assign = [](void* target, void* source)
+        {
+            *static_cast<value_type*>(target) = std::move(*static_cast<value_type*>(source));
+        };
+        result.destruct = [](void* value)
+        {
+            static_cast<value_type*>(value)->~value_type();
+        };
+
+        assert(command.value_offset + command.value_count == m_values.size());
+        m_values.push_back(result);
+        ++command.value_count;
+        command.mask.set(result.id);
+    }
+
+    entity reserve_entity();
+
+    /**
+     * @brief Allocate storage for a component value. Values are placed in fixed-size pages, so they
+     * never move until the buffer is cleared.
+     */
+    void* allocate(std::size_t size, std::size_t align);
+
+    world* m_world;
+
+    std::vector<command> m_commands;
+    std::vector<component_value> m_values;
+
+    std::vector<std::unique_ptr<std::uint8_t[]>> m_pages;
+    std::uint8_t* m_page_begin{nullptr};
+    std::uint8_t* m_page_end{nullptr};
+
+    static constexpr std::size_t PAGE_SIZE = 1024 * 4;
+};
+} // namespace violet
@@ -1,10 +1,14 @@
 #pragma once
 
 #include "core/ecs/archetype.hpp"
+#include <functional>
+#include <span>
+#include <tuple>
 
 namespace violet
 {
 class world;
+class task_executor;
 class view_base
 {
 public:
@@ -12,51 +16,461 @@ public:
     virtual ~view_base();
 
 protected:
-    const std::vector<archetype*>& sync_archetype_list();
-    void set_mask(const component_mask& mask) noexcept;
+    /**
+     * @brief Get the matching archetypes. The list is owned by the query cache of the world and
+     * grows when new archetypes are created, so callers iterate by index up to the size read before
+     * the iteration.
+     */
+    const std::vector<archetype*>& get_archetypes() const noexcept { return *m_archetypes; }
 
-    component_mask m_mask;
-    std::uint32_t m_version;
+    /**
+     * @brief Check the any_of terms, which are not part of the cached query.
+     */
+    bool is_match(const archetype* archetype) const noexcept
+    {
+        for (const component_mask& mask : m_any_masks)
+        {
+            if ((archetype->get_mask() & mask).none())
+                return false;
+        }
+        return true;
+    }
+
+    void set_mask(
+        const component_mask& include_mask,
+        const component_mask& exclude_mask,
+        std::vector<component_mask> any_masks);
+    void set_access(const component_mask& read_mask, const component_mask& write_mask) noexcept;
+
+    /**
+     * @brief Split the matched archetypes into chunks and dispatch them to the worker threads of
+     * the executor. The calling thread also processes chunks and helps with the other tasks until
+     * all chunks are finished. Views whose component access conflicts can not run at the same
+     * time, a view that conflicts with a running one logs an error and does not run.
+     */
+    void parallel_chunk(
+        task_executor& executor,
+        const std::function<void(archetype*, std::size_t)>& functor);
+
+    std::uint32_t advance_change_version() noexcept;
+
+    component_mask m_include_mask;
+    component_mask m_exclude_mask;
+    std::vector<component_mask> m_any_masks;
+
+    component_mask m_read_mask;
+    component_mask m_write_mask;
 
     world* m_world;
-    std::vector<archetype*> m_archetypes;
+    const std::vector<archetype*>* m_archetypes;
+};
+
+/**
+ * @brief View term that skips archetypes with any of the components.
+ */
+template <typename... Components>
+struct without
+{
+};
+
+/**
+ * @brief View term that matches archetypes with or without the components. The components are
+ * passed as pointers, or as spans to chunk functors, which are null or empty when the archetype
+ * does not have the component.
+ */
+template <typename... Components>
+struct optional
+{
 };
 
+/**
+ * @brief View term that matches archetypes with at least one of the components. The components are
+ * passed the same way as optional.
+ */
 template <typename... Components>
+struct any_of
+{
+};
+
+/**
+ * @brief Describes how a view term matches archetypes and what it passes to the functor. A plain
+ * component is required and passed by reference.
+ */
+template <typename Component>
+struct view_term
+{
+    using chunk_type = std::tuple<std::span<Component>>;
+
+    static void set_mask(component_mask& include_mask, component_mask&) noexcept
+    {
+        include_mask.set(component_index::value<std::remove_const_t<Component>>());
+    }
+
+    static void set_any_mask(std::vector<component_mask>&) {}
+
+    static void set_access(component_mask& read_mask, component_mask& write_mask) noexcept
+    {
+        if constexpr (std::is_const_v<Component>)
+            read_mask.set(component_index::value<std::remove_const_t<Component>>());
+        else
+            write_mask.set(component_index::value<Component>());
+    }
+
+    static chunk_type get_chunk(archetype* archetype, std::size_t chunk_index, std::size_t count)
+    {
+        return {
+            std::span<Component>(archetype->get_component_array<Component>(chunk_index), count)};
+    }
+
+    static std::tuple<Component&> get_entity(const chunk_type& chunk, std::size_t index) noexcept
+    {
+        return {std::get<0>(chunk)[index]};
+    }
+
+    static void mark_write(archetype* archetype, std::size_t chunk_index) noexcept
+    {
+        if constexpr (!std::is_const_v<Component>)
+            archetype->mark_changed(chunk_index, component_index::value<Component>());
+    }
+
+    static bool is_changed(archetype* archetype, std::size_t chunk_index, std::uint32_t since)
+    {
+        component_id id = component_index::value<std::remove_const_t<Component>>();
+        return archetype->get_chunk_version(chunk_index, id) > since;
+    }
+};
+
+template <typename... Components>
+struct view_term<without<Components...>>
+{
+    using chunk_type = std::tuple<>;
+
+    static void set_mask(component_mask&, component_mask& exclude_mask) noexcept
+    {
+        (exclude_mask.set(component_index::value<Components>()), ...);
+    }
+
+    static void set_any_mask(std::vector<component_mask>&) {}
+    static void set_access(component_mask&, component_mask&) noexcept {}
+
+    static chunk_type get_chunk(archetype*, std::size_t, std::size_t) { return {}; }
+
+    static std::tuple<> get_entity(const chunk_type&, std::size_t) noexcept { return {}; }
+
+    static void mark_write(archetype*, std::size_t) noexcept {}
+
+    static bool is_changed(archetype*, std::size_t, std::uint32_t) { return false; }
+};
+
+template <typename... Components>
+struct view_term<optional<Components...>>
+{
+    using chunk_type = std::tuple<std::span<Components>...>;
+
+    static void set_mask(component_mask&, component_mask&) noexcept {}
+    static void set_any_mask(std::vector<component_mask>&) {}
+
+    static void set_access(component_mask& read_mask, component_mask& write_mask) noexcept
+    {
+        (view_term<Components>::set_access(read_mask, write_mask), ...);
+    }
+
+    static chunk_type get_chunk(archetype* archetype, std::size_t chunk_index, std::size_t count)
+    {
+        return {get_array<Components>(archetype, chunk_index, count)...};
+    }
+
+    static std::tuple<Components*...> get_entity(const chunk_type& chunk, std::size_t index)
+    {
+        return {get_pointer(std::get<std::span<Components>>(chunk), index)...};
+    }
+
+    static void mark_write(archetype* archetype, std::size_t chunk_index) noexcept
+    {
+        (
+            [&]()
+            {
+                if (has_component<Components>(archetype))
+                    view_term<Components>::mark_write(archetype, chunk_index);
+            }(),
+            ...);
+    }
+
+    static bool is_changed(archetype* archetype, std::size_t chunk_index, std::uint32_t since)
+    {
+        return (
+            (has_component<Components>(archetype) &&
+             view_term<Components>::is_changed(archetype, chunk_index, since)) ||
+            ...);
+    }
+
+private:
+    template <typename Component>
+    static bool has_component(archetype* archetype) noexcept
+    {
+        return archetype->get_mask().test(component_index::value<std::remove_const_t<Component>>());
+    }
+
+    template <typename Component>
+    static std::span<Component> get_array(
+        archetype* archetype,
+        std::size_t chunk_index,
+        std::size_t count)
+    {
+        if (!has_component<Component>(archetype))
+            return {};
+        return std::span<Component>(archetype->get_component_array<Component>(chunk_index), count);
+    }
+
+    template <typename Component>
+    static Component* get_pointer(std::span<Component> array, std::size_t index) noexcept
+    {
+        return array.empty() ? nullptr : &array[index];
+    }
+};
+
+template <typename... Components>
+struct view_term<any_of<Components...>> : public view_term<optional<Components...>>
+{
+    static void set_any_mask(std::vector<component_mask>& any_masks)
+    {
+        component_mask mask;
+        (mask.set(component_index::value<std::remove_const_t<Components>>()), ...);
+        any_masks.push_back(mask);
+    }
+};
+
+/**
+ * @brief Iterate over all entities that match the terms. A term is either a required component,
+ * or one of without, optional and any_of. Terms are evaluated once per archetype, so entities
+ * that do not match are skipped a whole chunk at a time. Components declared as const are only
+ * read, which allows parallel views reading the same component to run at the same time.
+ */
+template <typename... Terms>
 class view : public view_base
 {
 public:
     view(world& world) : view_base(world)
     {
-        component_mask mask;
-        (mask.set(component_index::value<Components>()), ...);
-        set_mask(mask);
+        component_mask include_mask;
+        component_mask exclude_mask;
+        (view_term<Terms>::set_mask(include_mask, exclude_mask), ...);
+
+        std::vector<component_mask> any_masks;
+        (view_term<Terms>::set_any_mask(any_masks), ...);
+        set_mask(include_mask, exclude_mask, std::move(any_masks));
+
+        component_mask read_mask;
+        component_mask write_mask;
+        (view_term<Terms>::set_access(read_mask, write_mask), ...);
+        set_access(read_mask, write_mask);
     }
 
     template <typename Functor>
     void each(Functor&& functor)
     {
-        const std::vector<archetype*>& archetypes = sync_archetype_list();
+        each_archetype(
+            [&functor](archetype* archetype)
+            {
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+                    call_entity(archetype, i, functor);
+            });
+    }
 
-        for (archetype* archetype : archetypes)
-        {
-            std::tuple<Components*...> components;
-            for (std::size_t i = 0; i < archetype->size(); ++i)
+    /**
+     * @brief Call the functor once per chunk with the entity count of the chunk and a contiguous
+     * span of each component.
+     *
+     * @param functor void(std::size_t count, std::span<Components>... components)
+     */
+    template <typename Functor>
+    void each_chunk(Functor&& functor)
+    {
+        each_archetype(
+            [&functor](archetype* archetype)
+            {
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+                    call_chunk(archetype, i, functor);
+            });
+    }
+
+    /**
+     * @brief Same as each_chunk, but only visits archetypes that have the shared components and
+     * passes the values of each chunk, so chunks can be batched by value.
+     *
+     * @param functor void(const Shared&... shared, std::size_t count,
+     * std::span<Components>... components)
+     */
+    template <typename... Shared, typename Functor>
+    void each_chunk_shared(Functor&& functor)
+    {
+        each_archetype(
+            [&functor](archetype* archetype)
+            {
+                if ((!archetype->get_mask().test(component_index::value<Shared>()) || ...))
+                    return;
+
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+                {
+                    auto chunk_functor = [&](std::size_t count, auto... components)
+                    {
+                        functor(
+                            *archetype->get_shared_component<Shared>(i)...,
+                            count,
+                            components...);
+                    };
+                    call_chunk(archetype, i, chunk_functor);
+                }
+            });
+    }
+
+    /**
+     * @brief Same as each, but only visits chunks in which one of the filter components has been
+     * written since the version. When no filter component is given, all components of the view are
+     * checked. Filter components should be declared const in the view, otherwise the iteration
+     * itself stamps them.
+     *
+     * @param version The version returned by the last call, updated to the current version.
+     */
+    template <typename... Filters, typename Functor>
+    void each_changed(std::uint32_t& version, Functor&& functor)
+    {
+        std::uint32_t since = version;
+        version = advance_change_version();
+
+        each_archetype(
+            [&functor, since](archetype* archetype)
+            {
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+                {
+                    if (is_changed<Filters...>(archetype, i, since))
+                        call_entity(archetype, i, functor);
+                }
+            });
+    }
+
+    template <typename... Filters, typename Functor>
+    void each_chunk_changed(std::uint32_t& version, Functor&& functor)
+    {
+        std::uint32_t since = version;
+        version = advance_change_version();
+
+        each_archetype(
+            [&functor, since](archetype* archetype)
             {
-                if (i % archetype->entity_per_chunk() == 0)
+                for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
                 {
-                    auto iter = archetype->begin() + i;
-                    components = {&iter.template get_component<Components>()...};
+                    if (is_changed<Filters...>(archetype, i, since))
+                        call_chunk(archetype, i, functor);
                 }
+            });
+    }
+
+    /**
+     * @brief Same as each, but chunks are processed in parallel on the task executor. The functor
+     * is called concurrently and must not make structural changes to the world.
+     */
+    template <typename Functor>
+    void parallel_each(task_executor& executor, Functor&& functor)
+    {
+        parallel_chunk(
+            executor,
+            [&functor](archetype* archetype, std::size_t chunk_index)
+            {
+                call_entity(archetype, chunk_index, functor);
+            });
+    }
+
+    template <typename Functor>
+    void parallel_each_chunk(task_executor& executor, Functor&& functor)
+    {
+        parallel_chunk(
+            executor,
+            [&functor](archetype* archetype, std::size_t chunk_index)
+            {
+                call_chunk(archetype, chunk_index, functor);
+            });
+    }
+
+private:
+    using chunk_type = std::tuple<typename view_term<Terms>::chunk_type...>;
+
+    template <typename Functor>
+    void each_archetype(Functor&& functor)
+    {
+        const std::vector<archetype*>& archetypes = get_archetypes();
 
-                std::apply(
-                    [&](auto&&... args) {
-                        functor(*args...);
-                        (++args, ...);
-                    },
-                    components);
-            }
+        std::size_t archetype_count = archetypes.size();
+        for (std::size_t i = 0; i < archetype_count; ++i)
+        {
+            if (is_match(archetypes[i]))
+                functor(archetypes[i]);
         }
     }
+
+    static chunk_type get_chunk(archetype* archetype, std::size_t chunk_index, std::size_t count)
+    {
+        (view_term<Terms>::mark_write(archetype, chunk_index), ...);
+        return {view_term<Terms>::get_chunk(archetype, chunk_index, count)...};
+    }
+
+    template <typename Functor>
+    static void call_chunk(archetype* archetype, std::size_t chunk_index, Functor& functor)
+    {
+        // Released chunk slots of archetypes with shared components are empty.
+        std::size_t count = archetype->get_chunk_size(chunk_index);
+        if (count == 0)
+            return;
+
+        call_chunk(
+            get_chunk(archetype, chunk_index, count),
+            count,
+            functor,
+            std::index_sequence_for<Terms...>());
+    }
+
+    template <typename Functor, std::size_t... Indices>
+    static void call_chunk(
+        const chunk_type& chunk,
+        std::size_t count,
+        Functor& functor,
+        std::index_sequence<Indices...>)
+    {
+        std::apply(functor, std::tuple_cat(std::make_tuple(count), std::get<Indices>(chunk)...));
+    }
+
+    template <typename Functor>
+    static void call_entity(archetype* archetype, std::size_t chunk_index, Functor& functor)
+    {
+        std::size_t count = archetype->get_chunk_size(chunk_index);
+        if (count == 0)
+            return;
+
+        chunk_type chunk = get_chunk(archetype, chunk_index, count);
+
+        for (std::size_t i = 0; i < count; ++i)
+            call_entity(chunk, i, functor, std::index_sequence_for<Terms...>());
+    }
+
+    template <typename Functor, std::size_t... Indices>
+    static void call_entity(
+        const chunk_type& chunk,
+        std::size_t index,
+        Functor& functor,
+        std::index_sequence<Indices...>)
+    {
+        std::apply(
+            functor,
+            std::tuple_cat(view_term<Terms>::get_entity(std::get<Indices>(chunk), index)...));
+    }
+
+    template <typename... Filters>
+    static bool is_changed(archetype* archetype, std::size_t chunk_index, std::uint32_t since)
+    {
+        if constexpr (sizeof...(Filters) == 0)
+            return (view_term<Terms>::is_changed(archetype, chunk_index, since) || ...);
+        else
+            return (view_term<Filters>::is_changed(archetype, chunk_index, since) || ...);
+    }
 };
-} // namespace violet
\ No newline at end of file
+} // namespace violet
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "core/ecs/entity.hpp"
+#include "core/ecs/entity_command_buffer.hpp"
 #include "core/ecs/view.hpp"
 #include <functional>
-#include <queue>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 
 namespace violet
@@ -13,6 +16,16 @@ struct entity_record
     std::size_t entity_index;
 };
 
+struct world_memory_stats
+{
+    // Bytes of components of all entities.
+    std::size_t used_bytes;
+    // Bytes of chunks held by archetypes.
+    std::size_t allocated_bytes;
+    // Bytes of all chunks, including free chunks kept by the pools.
+    std::size_t reserved_bytes;
+};
+
 class world
 {
 public:
@@ -22,21 +35,97 @@ public:
 private:
     struct entity_info
     {
-        std::uint16_t entity_version;
-        std::uint16_t component_version;
+        std::uint16_t entity_version{0};
+        std::uint16_t component_version{0};
+
+        archetype* archetype{nullptr};
+        std::size_t archetype_index{0};
 
-        archetype* archetype;
-        std::size_t archetype_index;
+        // Next index in the free list, only meaningful while the index is free.
+        std::atomic<std::uint32_t> next_free{INVALID_ENTITY_INDEX};
     };
 
 public:
-    world();
+    /**
+     * @brief Location of a component cached by get_component. It is valid while the entity stays in
+     * the same archetype at the same index, which is tracked by the component version.
+     */
+    struct component_cache
+    {
+        void* component{nullptr};
+        archetype* archetype{nullptr};
+        std::size_t version_index{0};
+        std::uint16_t entity_version{0};
+        std::uint16_t component_version{0};
+    };
+
+    /**
+     * @param chunk_size Default chunk size of archetypes, see set_chunk_size.
+     */
+    world(std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    /**
+     * @brief Create a world that shares a component table with other worlds, so entities can be
+     * merged between them. A component registered in one of the worlds is registered in all of
+     * them, components should be registered before the worlds are used on other threads.
+     */
+    world(
+        std::shared_ptr<component_table> component_table,
+        std::size_t chunk_size = DEFAULT_CHUNK_SIZE);
     ~world();
 
     [[nodiscard]] entity create(actor* owner);
 
+    /**
+     * @brief Reserve an entity. This is thread-safe and lock-free, so entities can be prepared on
+     * worker threads while the main thread uses the world. The entity has no components until it
+     * is placed on the main thread, by create(entity, actor*) or by a command buffer.
+     */
+    [[nodiscard]] entity reserve_entity();
+
+    /**
+     * @brief Place a reserved entity in the world.
+     */
+    void create(entity entity, actor* owner);
+
     void release(entity entity);
 
+    /**
+     * @brief Create an entity for each owner with the components in one pass. Entities are placed
+     * directly in the final archetype, so no intermediate archetype moves happen.
+     *
+     * @param owners The owner of each entity.
+     * @return std::vector<entity> The created entities, in the same order as the owners.
+     */
+    template <typename... Components>
+    [[nodiscard]] std::vector<entity> create_batch(std::span<actor* const> owners)
+    {
+        (assert(is_component_register<Components>()), ...);
+        return create_batch(
+            get_or_create_archetype<actor*, entity_record, Components...>(),
+            owners);
+    }
+
+    void release_batch(std::span<const entity> entities);
+
+    /**
+     * @brief Get the command buffer of the calling thread. Commands recorded into it are applied by
+     * the next call to playback().
+     */
+    [[nodiscard]] entity_command_buffer& get_command_buffer();
+
+    /**
+     * @brief Apply the commands of all thread command buffers and clear them. Must be called at a
+     * sync point where no view is iterating and no task is recording.
+     */
+    void playback();
+
+    /**
+     * @brief Apply the commands of the buffers in one pass. All commands of an entity are folded
+     * into a single archetype move, and the moves are grouped by target archetype.
+     */
+    void playback(std::span<entity_command_buffer* const> buffers);
+
     template <
         typename Component,
         typename ComponentInfo = component_info_default<Component>,
@@ -48,6 +137,17 @@ public:
         m_component_table[id] = std::make_unique<ComponentInfo>(std::forward<Args>(args)...);
     }
 
+    /**
+     * @brief Register a component whose value is stored once per chunk, see
+     * shared_component_info. Shared components are set with set_shared_component and read with
+     * get_shared_component or view::each_chunk_shared.
+     */
+    template <typename Component, typename Hash = shared_component_hash<Component>>
+    void register_shared_component()
+    {
+        register_component<Component, shared_component_info<Component, Hash>>();
+    }
+
     template <typename Component>
     bool is_component_register()
     {
@@ -59,28 +159,29 @@ public:
     void add_component(entity entity)
     {
         (assert(is_component_register<Components>()), ...);
+        (assert(!m_component_table[component_index::value<Components>()]->is_shared()), ...);
 
-        entity_info& info = m_entity_infos[entity.index];
+        entity_info& info = get_entity_info(entity.index);
 
         archetype* old_archetype = info.archetype;
         archetype* new_archetype = nullptr;
 
-        component_mask new_mask = make_mask<Components...>();
-        if (old_archetype != nullptr)
-            new_mask |= old_archetype->get_mask();
-
-        auto iter = m_archetypes.find(new_mask);
-        if (iter == m_archetypes.cend())
+        if constexpr (sizeof...(Components) == 1)
         {
-            std::vector<component_id> components;
             if (old_archetype != nullptr)
-                components = old_archetype->get_components();
-            (components.push_back(component_index::value<Components>()), ...);
-            new_archetype = make_archetype(components);
+            {
+                new_archetype =
+                    get_add_archetype(old_archetype, component_index::value<Components>()...);
+            }
         }
-        else
+
+        if (new_archetype == nullptr)
         {
-            new_archetype = iter->second.get();
+            component_mask new_mask = make_mask<Components...>();
+            if (old_archetype != nullptr)
+                new_mask |= old_archetype->get_mask();
+
+            new_archetype = get_or_create_archetype(new_mask);
         }
 
         if (old_archetype != nullptr)
@@ -99,37 +200,31 @@ public:
     template <typename... Components>
     void remove_component(entity entity)
     {
-        entity_info& info = m_entity_infos[entity.index];
+        entity_info& info = get_entity_info(entity.index);
         assert(info.archetype);
 
+        if constexpr (sizeof...(Components) == 1)
+        {
+            if (info.archetype->get_components().size() != 1)
+            {
+                archetype* old_archetype = info.archetype;
+                archetype* new_archetype =
+                    get_remove_archetype(old_archetype, component_index::value<Components>()...);
+
+                std::size_t new_archetype_index =
+                    old_archetype->move(info.archetype_index, *new_archetype);
+                on_entity_move(entity.index, new_archetype, new_archetype_index);
+                return;
+            }
+        }
+
         component_mask new_mask = info.archetype->get_mask() ^ make_mask<Components...>();
         assert(new_mask != info.archetype->get_mask());
 
         if (!new_mask.none())
         {
             archetype* old_archetype = info.archetype;
-            archetype* new_archetype = nullptr;
-
-            auto iter = m_archetypes.find(new_mask);
-            if (iter == m_archetypes.cend())
-            {
-                component_mask remove_mask;
-                (remove_mask.set(component_index::value<Components>()), ...);
-
-                std::vector<component_id> old_components = info.archetype->get_components();
-                std::vector<component_id> new_components;
-                for (component_id id : old_components)
-                {
-                    if (!remove_mask.test(id))
-                        new_components.push_back(id);
-                }
-
-                new_archetype = make_archetype(new_components);
-            }
-            else
-            {
-                new_archetype = iter->second.get();
-            }
+            archetype* new_archetype = get_or_create_archetype(new_mask);
 
             std::size_t new_archetype_index =
                 old_archetype->move(info.archetype_index, *new_archetype);
@@ -161,14 +256,90 @@ public:
      */
     [[nodiscard]] std::pair<std::uint16_t, std::uint16_t> get_version(entity entity) const;
 
+    /**
+     * @brief Get the component of the entity. A mutable access is treated as a write, so the chunk
+     * is stamped with the current change version. Use a const component type, as in views, to read
+     * the component without stamping.
+     */
     template <typename Component>
     [[nodiscard]] Component& get_component(entity entity)
+    {
+        using type = std::remove_const_t<Component>;
+        assert(has_component<type>(entity));
+
+        entity_info& info = get_entity_info(entity.index);
+        if constexpr (!std::is_const_v<Component>)
+        {
+            info.archetype->mark_changed(
+                info.archetype_index / info.archetype->entity_per_chunk(),
+                component_index::value<type>());
+        }
+
+        auto iter = info.archetype->begin() + info.archetype_index;
+        return iter.get_component<type>();
+    }
+
+    /**
+     * @brief Get the component of the entity through a cache. When the entity has not moved since
+     * the cache was filled, the cached pointer is returned after a version check instead of
+     * looking up the archetype and column. Only a mutable access stamps the chunk.
+     */
+    template <typename Component>
+    [[nodiscard]] Component& get_component(entity entity, component_cache& cache)
+    {
+        using type = std::remove_const_t<Component>;
+
+        // The entity version is compared too, a stale handle whose slot was reused by another
+        // entity must not see the components of that entity.
+        entity_info& info = get_entity_info(entity.index);
+        if (cache.component != nullptr && cache.archetype == info.archetype &&
+            cache.entity_version == entity.entity_version &&
+            info.entity_version == entity.entity_version &&
+            cache.component_version == info.component_version)
+        {
+            if constexpr (!std::is_const_v<Component>)
+                cache.archetype->mark_changed_at(cache.version_index);
+            return *static_cast<Component*>(cache.component);
+        }
+
+        Component& result = get_component<Component>(entity);
+
+        cache.component = const_cast<type*>(&result);
+        cache.archetype = info.archetype;
+        cache.version_index = info.archetype->get_chunk_version_index(
+            info.archetype_index / info.archetype->entity_per_chunk(),
+            component_index::value<type>());
+        cache.entity_version = info.entity_version;
+        cache.component_version = info.component_version;
+
+        return result;
+    }
+
+    /**
+     * @brief Set the value of a shared component. The entity moves to the chunks of the value, the
+     * component is added when the entity does not have it yet.
+     */
+    template <typename Component>
+    void set_shared_component(entity entity, const Component& value)
+    {
+        component_id id = component_index::value<Component>();
+        component_info* info = m_component_table[id].get();
+        assert(info != nullptr && info->is_shared());
+
+        // Hold a reference while the entity moves, the chunks of the value take their own.
+        const void* shared_value = info->acquire_shared_value(&value);
+        set_shared_component(entity, id, shared_value);
+        info->release_shared_value(shared_value);
+    }
+
+    template <typename Component>
+    [[nodiscard]] const Component& get_shared_component(entity entity)
     {
         assert(has_component<Component>(entity));
 
-        auto iter = m_entity_infos[entity.index].archetype->begin() +
-                    m_entity_infos[entity.index].archetype_index;
-        return iter.get_component<Component>();
+        const entity_info& info = get_entity_info(entity.index);
+        return *info.archetype->get_shared_component<Component>(
+            info.archetype_index / info.archetype->entity_per_chunk());
     }
 
     template <typename Component>
@@ -181,12 +352,200 @@ public:
     [[nodiscard]] bool has_component(entity entity, component_id component)
     {
         assert(is_valid(entity).first);
-        return m_entity_infos[entity.index].archetype->get_mask().test(component);
+        return get_entity_info(entity.index).archetype->get_mask().test(component);
+    }
+
+    /**
+     * @brief Get the current change version. Component writes are stamped with this version.
+     */
+    [[nodiscard]] std::uint32_t get_change_version() const noexcept
+    {
+        return m_change_version.load(std::memory_order_relaxed);
     }
 
+    /**
+     * @brief Increase the change version, so that writes from now on are stamped with a newer
+     * version.
+     *
+     * @return std::uint32_t The version before increasing. Chunks stamped with a version greater
+     * than it are written after this call.
+     */
+    std::uint32_t advance_change_version() noexcept { return m_change_version.fetch_add(1); }
+
+    /**
+     * @brief Declare that components are going to be accessed concurrently. It never blocks, the
+     * caller may be a worker the conflicting access needs to finish.
+     *
+     * @param read_mask Components that are only read.
+     * @param write_mask Components that are written.
+     * @return false if another access writes the components being read or touches the components
+     * being written.
+     */
+    bool try_lock_access(const component_mask& read_mask, const component_mask& write_mask);
+    void unlock_access(const component_mask& read_mask, const component_mask& write_mask);
+
+    /**
+     * @brief Move all entities of another world sharing the component table into this world.
+     * Archetypes with the same chunk size take over the chunks of the other world instead of
+     * copying each entity. Entities get new handles in this world and actors are moved along.
+     * Neither world may be used by other threads during the merge.
+     *
+     * @return std::vector<entity> The new entity of each entity index of the other world.
+     */
+    std::vector<entity> merge(world& other);
+
+    [[nodiscard]] const std::shared_ptr<component_table>& get_component_table() const noexcept
+    {
+        return m_component_registry;
+    }
+
+    /**
+     * @brief Write all entities to a binary snapshot. Columns of trivially copyable components are
+     * written as raw memory, other components through component_info::serialize. The snapshot only
+     * contains offsets, so it can be loaded straight from a memory mapped file. Shared components
+     * are not written.
+     */
+    [[nodiscard]] std::vector<std::uint8_t> save() const;
+
+    /**
+     * @brief Create the entities of a snapshot. Components are matched by type hash, components
+     * that are not registered in this world are skipped. actor* components are null after loading.
+     *
+     * @return std::vector<entity> The new entity of each entity index of the saved world, used to
+     * fix up entity references inside components. Empty if the snapshot is truncated or corrupt,
+     * in which case the world is left unchanged.
+     */
+    std::vector<entity> load(std::span<const std::uint8_t> snapshot);
+
+    /**
+     * @brief Sort the entities of the archetype by a key computed from their components, so that
+     * views visit them in key order, e.g. by hierarchy depth, material or spatial cell.
+     *
+     * @param key Key(const Components&...), the keys are compared with operator<.
+     */
+    template <typename... Components, typename Functor>
+    void sort(archetype* archetype, Functor&& key)
+    {
+        std::vector<std::size_t> indices;
+        std::vector<std::size_t> order = get_sort_order<Components...>(archetype, key, indices);
+        if (!order.empty())
+            reorder(archetype, indices, order, archetype->size());
+    }
+
+    /**
+     * @brief Sort the entities of all archetypes with the components.
+     */
+    template <typename... Components, typename Functor>
+    void sort(Functor&& key)
+    {
+        component_mask mask = make_mask<Components...>();
+        for (auto& [archetype_mask, archetype] : m_archetypes)
+        {
+            if ((archetype_mask & mask) == mask)
+                sort<Components...>(archetype.get(), key);
+        }
+    }
+
+    /**
+     * @brief Move the entities of all archetypes with the components towards key order, with at
+     * most max_swap swaps per call, so the cost of moving data is spread across frames. Only
+     * archetypes whose key components were written, added or moved since they were last found in
+     * key order are checked, so the key must only depend on the components, and an archetype
+     * should always be defragmented with the same key.
+     *
+     * @return std::size_t The number of swaps, 0 when all archetypes are in key order.
+     */
+    template <typename... Components, typename Functor>
+    std::size_t defragment(Functor&& key, std::size_t max_swap)
+    {
+        component_mask mask = make_mask<Components...>();
+
+        std::size_t result = 0;
+        std::vector<std::size_t> indices;
+        for (auto& [archetype_mask, archetype] : m_archetypes)
+        {
+            if (result == max_swap)
+                break;
+
+            if ((archetype_mask & mask) != mask ||
+                !is_order_changed<Components...>(archetype.get()))
+                continue;
+
+            std::vector<std::size_t> order =
+                get_sort_order<Components...>(archetype.get(), key, indices);
+
+            std::size_t budget = max_swap - result;
+            std::size_t swap_count =
+                order.empty() ? 0 : reorder(archetype.get(), indices, order, budget);
+            result += swap_count;
+
+            // The archetype is in key order when the budget was not used up. The swaps stamped the
+            // chunks with the current version, which writes from now on no longer use.
+            if (swap_count < budget)
+                archetype->set_ordered_version(advance_change_version());
+        }
+        return result;
+    }
+
+    /**
+     * @brief Set the chunk size of the archetype of entities with the components. Archetypes with
+     * few entities can use small chunks and archetypes with many entities large ones. Must be
+     * called before the archetype is created. Archetypes with the same chunk size share a pool of
+     * chunks.
+     */
+    template <typename... Components>
+    void set_chunk_size(std::size_t chunk_size)
+    {
+        component_mask mask = make_mask<actor*, entity_record, Components...>();
+        assert(std::none_of(
+            m_archetypes.begin(),
+            m_archetypes.end(),
+            [&mask](const auto& pair)
+            {
+                return pair.first == mask;
+            }));
+        m_chunk_sizes[mask] = chunk_size;
+    }
+
+    /**
+     * @brief Return free chunks to the system. Each chunk pool keeps enough free chunks to reach
+     * the peak usage since the last trim, so calling trim periodically releases memory that has not
+     * been needed for a whole period.
+     *
+     * @return std::size_t The number of released bytes.
+     */
+    std::size_t trim();
+
+    [[nodiscard]] world_memory_stats get_memory_stats() const;
+
 private:
     friend class view_base;
 
+    struct query_key
+    {
+        component_mask include;
+        component_mask exclude;
+
+        bool operator==(const query_key& other) const noexcept = default;
+    };
+
+    struct query_key_hash
+    {
+        std::size_t operator()(const query_key& key) const noexcept
+        {
+            std::size_t result = std::hash<component_mask>()(key.include);
+            result ^= std::hash<component_mask>()(key.exclude) + 0x9e3779b9 + (result << 6) +
+                      (result >> 2);
+            return result;
+        }
+    };
+
+    struct component_access
+    {
+        component_mask read_mask;
+        component_mask write_mask;
+    };
+
     void on_entity_move(
         std::size_t entity_index,
         archetype* new_archetype,
@@ -204,17 +563,12 @@ private:
     archetype* get_or_create_archetype()
     {
         component_mask mask = make_mask<Components...>();
-        auto& result = m_archetypes[mask];
 
-        if (result == nullptr)
-        {
-            ++m_view_version;
+        auto iter = m_archetypes.find(mask);
+        if (iter == m_archetypes.cend())
             return make_archetype<Components...>();
-        }
         else
-        {
-            return result.get();
-        }
+            return iter->second.get();
     }
 
     template <typename... Components>
@@ -227,14 +581,191 @@ private:
 
     archetype* make_archetype(const std::vector<component_id>& components);
 
-    std::queue<std::uint32_t> m_free_entity;
+    std::vector<entity> create_batch(archetype* archetype, std::span<actor* const> owners);
 
-    std::uint32_t m_view_version;
+    /**
+     * @brief Place reserved entities in the archetype, without shared component values.
+     */
+    void place_batch(
+        archetype* archetype,
+        std::span<actor* const> owners,
+        std::span<entity> entities);
 
-    std::unique_ptr<archetype_chunk_allocator> m_archetype_chunk_allocator;
+    archetype* get_or_create_archetype(const component_mask& mask);
+
+    void set_shared_component(entity entity, component_id component, const void* value);
+
+    /**
+     * @brief Get the archetype reached by adding or removing a single component. The transition is
+     * cached on the source archetype, so only the first transition needs to look up the mask.
+     */
+    archetype* get_add_archetype(archetype* source, component_id component);
+    archetype* get_remove_archetype(archetype* source, component_id component);
+
+    archetype_chunk_allocator* get_chunk_allocator(const component_mask& mask);
+
+    /**
+     * @brief Get the archetypes that have all components of the include mask and none of the
+     * exclude mask. The result is cached per mask pair and archetypes created later are appended
+     * to it, so the reference stays valid for the lifetime of the world.
+     */
+    const std::vector<archetype*>& get_archetypes(
+        const component_mask& include,
+        const component_mask& exclude);
+
+    /**
+     * @brief Whether a key component of the archetype was written, added or moved since the
+     * archetype was last found in key order.
+     */
+    template <typename... Components>
+    bool is_order_changed(const archetype* archetype) const noexcept
+    {
+        std::uint32_t version = archetype->get_ordered_version();
+        for (std::size_t i = 0; i < archetype->get_chunk_count(); ++i)
+        {
+            bool changed =
+                ((archetype->get_chunk_version(i, component_index::value<Components>()) >
+                  version) ||
+                 ...);
+            if (changed)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Get the position of the entity that belongs at each position in key order. Positions
+     * go through the chunks of each group of shared component values in turn, and entities are
+     * only sorted within their group.
+     *
+     * @param indices Receives the archetype index of each position.
+     * @return std::vector<std::size_t> Empty when the entities are already in key order.
+     */
+    template <typename... Components, typename Functor>
+    std::vector<std::size_t> get_sort_order(
+        archetype* archetype,
+        Functor& key,
+        std::vector<std::size_t>& indices)
+    {
+        using key_type = std::decay_t<std::invoke_result_t<Functor&, const Components&...>>;
+
+        auto compare = [](const auto& a, const auto& b)
+        {
+            return a.first < b.first;
+        };
+
+        std::vector<std::pair<key_type, std::size_t>> keys;
+        keys.reserve(archetype->size());
+        indices.clear();
+        indices.reserve(archetype->size());
+
+        bool sorted = true;
+        for (std::size_t group = 0; group < archetype->get_group_count(); ++group)
+        {
+            std::size_t group_begin = keys.size();
+            for (std::size_t chunk_index : archetype->get_group_chunks(group))
+            {
+                std::tuple<const Components*...> arrays = {
+                    archetype->get_component_array<const Components>(chunk_index)...};
+
+                std::size_t chunk_size = archetype->get_chunk_size(chunk_index);
+                for (std::size_t j = 0; j < chunk_size; ++j)
+                {
+                    keys.emplace_back(
+                        key(std::get<const Components*>(arrays)[j]...),
+                        keys.size());
+                    indices.push_back(chunk_index * archetype->entity_per_chunk() + j);
+                }
+            }
+
+            // Keys rarely change between calls, checking the order is cheaper than sorting.
+            if (!std::is_sorted(keys.begin() + group_begin, keys.end(), compare))
+            {
+                std::stable_sort(keys.begin() + group_begin, keys.end(), compare);
+                sorted = false;
+            }
+        }
+
+        if (sorted)
+            return {};
+
+        std::vector<std::size_t> result(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            result[i] = keys[i].second;
+        return result;
+    }
+
+    /**
+     * @brief Swap entities until each position holds the entity given by the order, or max_swap
+     * swaps are done. Every swap puts one entity at its final position.
+     *
+     * @param indices The archetype index of each position.
+     * @return std::size_t The number of swaps.
+     */
+    std::size_t reorder(
+        archetype* archetype,
+        const std::vector<std::size_t>& indices,
+        const std::vector<std::size_t>& order,
+        std::size_t max_swap);
+
+    entity_info& get_entity_info(std::uint32_t index) noexcept
+    {
+        return m_entity_pages[index / ENTITY_PAGE_SIZE].load(
+            std::memory_order_acquire)[index % ENTITY_PAGE_SIZE];
+    }
+
+    const entity_info& get_entity_info(std::uint32_t index) const noexcept
+    {
+        return m_entity_pages[index / ENTITY_PAGE_SIZE].load(
+            std::memory_order_acquire)[index % ENTITY_PAGE_SIZE];
+    }
+
+    /**
+     * @brief Get the info of an index that may be reserved concurrently. The count is bumped before
+     * the page is installed, so the page of an index below the count may still be missing.
+     */
+    const entity_info* find_entity_info(std::uint32_t index) const noexcept
+    {
+        if (index >= m_entity_count.load(std::memory_order_acquire))
+            return nullptr;
+
+        const entity_info* page =
+            m_entity_pages[index / ENTITY_PAGE_SIZE].load(std::memory_order_acquire);
+        return page == nullptr ? nullptr : &page[index % ENTITY_PAGE_SIZE];
+    }
+
+    void push_free_entity(std::uint32_t index) noexcept;
+
+    static constexpr std::size_t ENTITY_PAGE_SIZE = 1024 * 4;
+    static constexpr std::size_t MAX_ENTITY_PAGE = 1024 * 16;
+
+    // Entity infos are stored in pages that never move, so indices can be reserved while other
+    // threads read the infos.
+    std::array<std::atomic<entity_info*>, MAX_ENTITY_PAGE> m_entity_pages;
+    std::atomic<std::uint32_t> m_entity_count;
+
+    // Head of the lock-free stack of free indices. The high 32 bits are a tag that changes on every
+    // push and pop, which prevents ABA problems.
+    std::atomic<std::uint64_t> m_free_entity;
+
+    std::atomic<std::uint32_t> m_change_version;
+
+    // Declared before the archetypes, which use the component table until they are destroyed.
+    std::shared_ptr<component_table> m_component_registry;
+    component_table& m_component_table;
+
+    std::size_t m_chunk_size;
+    std::unordered_map<component_mask, std::size_t> m_chunk_sizes;
+    std::unordered_map<std::size_t, std::unique_ptr<archetype_chunk_allocator>> m_chunk_allocators;
     std::unordered_map<component_mask, std::unique_ptr<archetype>> m_archetypes;
 
-    component_table m_component_table;
-    std::vector<entity_info> m_entity_infos;
+    std::unordered_map<query_key, std::vector<archetype*>, query_key_hash> m_queries;
+    std::mutex m_query_lock;
+
+    std::unordered_map<std::thread::id, std::unique_ptr<entity_command_buffer>> m_command_buffers;
+    std::mutex m_command_buffer_lock;
+
+    std::vector<component_access> m_accesses;
+    std::mutex m_access_lock;
 };
 } // namespace violet
\ No newline at end of file
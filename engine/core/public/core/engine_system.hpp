@@ -40,6 +40,17 @@ protected:
     task<>& on_frame_end();
     task<float>& on_tick();
 
+    /**
+     * @brief Root of the render stage, executed after frame end. In pipelined mode the render stage
+     * of a frame runs concurrently with the tick of the next frame, so its tasks should only read
+     * data extracted during frame end.
+     *
+     * The argument is the index of the frame to render, counted from 0 with one frame per frame
+     * end. It is chosen before the stage starts, so it does not depend on how far the next frame
+     * is extracted.
+     */
+    task<std::size_t>& on_render();
+
 private:
     friend class engine;
 
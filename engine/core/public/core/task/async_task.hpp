@@ -0,0 +1,318 @@
+#pragma once
+
+#include "core/task/task.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <string>
+
+namespace violet
+{
+/**
+ * @brief Task that resumes a suspended coroutine. It belongs to no graph, so executing it does not
+ * count towards the execution of a graph.
+ */
+class task_resume : public task_base
+{
+public:
+    task_resume(task_option option, std::coroutine_handle<> handle = nullptr) noexcept
+        : task_base(option),
+          m_handle(handle)
+    {
+    }
+
+    void set_handle(std::coroutine_handle<> handle) noexcept { m_handle = handle; }
+
+    virtual task_base* execute() override
+    {
+        // The task usually lives in the coroutine frame, which may be destroyed while resumed.
+        m_handle.resume();
+        return nullptr;
+    }
+
+private:
+    std::coroutine_handle<> m_handle;
+};
+
+class async_promise_base
+{
+public:
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    auto final_suspend() noexcept { return final_awaiter{}; }
+
+    void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+    task_resume& start(std::coroutine_handle<> handle, task_option option)
+    {
+        m_start.emplace(option, handle);
+        return *m_start;
+    }
+
+    void set_continuation(std::coroutine_handle<> continuation) noexcept
+    {
+        m_continuation = continuation;
+    }
+
+    bool is_done() const
+    {
+        std::lock_guard<std::mutex> lg(m_lock);
+        return m_done;
+    }
+
+    void wait() const
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_done_condition.wait(
+            lock,
+            [this]()
+            {
+                return m_done;
+            });
+    }
+
+protected:
+    void rethrow_exception() const
+    {
+        if (m_exception)
+            std::rethrow_exception(m_exception);
+    }
+
+private:
+    /**
+     * @brief Marks the coroutine done and continues with the awaiting coroutine, if any.
+     */
+    struct final_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            return handle.promise().complete();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::coroutine_handle<> complete() noexcept
+    {
+        // A waiting thread may destroy the frame as soon as the lock is released.
+        std::coroutine_handle<> continuation = m_continuation;
+        {
+            std::lock_guard<std::mutex> lg(m_lock);
+            m_done = true;
+            m_done_condition.notify_all();
+        }
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    std::optional<task_resume> m_start;
+    std::coroutine_handle<> m_continuation;
+    std::exception_ptr m_exception;
+
+    bool m_done{false};
+    mutable std::mutex m_lock;
+    mutable std::condition_variable m_done_condition;
+};
+
+template <typename T>
+class async_task;
+
+template <typename T>
+class async_promise : public async_promise_base
+{
+public:
+    async_task<T> get_return_object() noexcept;
+
+    void return_value(T value) { m_result.emplace(std::move(value)); }
+
+    T& get_result()
+    {
+        rethrow_exception();
+        return *m_result;
+    }
+
+private:
+    std::optional<T> m_result;
+};
+
+template <>
+class async_promise<void> : public async_promise_base
+{
+public:
+    async_task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void get_result() { rethrow_exception(); }
+};
+
+/**
+ * @brief Coroutine that runs on a task_executor. It starts suspended, and runs when it is scheduled
+ * with task_executor::schedule or awaited by another async_task. Awaiting it resumes the awaiting
+ * coroutine on the thread that completes it.
+ *
+ * @tparam T The type of co_return.
+ */
+template <typename T = void>
+class async_task
+{
+public:
+    using promise_type = async_promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+public:
+    async_task(handle_type handle) noexcept : m_handle(handle) {}
+    async_task(const async_task&) = delete;
+    async_task(async_task&& other) noexcept : m_handle(other.m_handle) { other.m_handle = nullptr; }
+
+    /**
+     * @brief Destroy the coroutine, which must not be running.
+     */
+    ~async_task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    bool is_done() const { return m_handle.promise().is_done(); }
+
+    /**
+     * @brief Block until the coroutine has returned. Should not be called by a worker, which would
+     * stop running tasks meanwhile.
+     */
+    void wait() const { m_handle.promise().wait(); }
+
+    decltype(auto) get()
+    {
+        wait();
+        return m_handle.promise().get_result();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        m_handle.promise().set_continuation(caller);
+        return m_handle;
+    }
+
+    decltype(auto) await_resume() { return m_handle.promise().get_result(); }
+
+    task_resume& start(task_option option) { return m_handle.promise().start(m_handle, option); }
+
+    async_task& operator=(const async_task&) = delete;
+    async_task& operator=(async_task&& other) noexcept
+    {
+        if (m_handle)
+            m_handle.destroy();
+        m_handle = other.m_handle;
+        other.m_handle = nullptr;
+        return *this;
+    }
+
+private:
+    handle_type m_handle;
+};
+
+template <typename T>
+async_task<T> async_promise<T>::get_return_object() noexcept
+{
+    return async_task<T>(std::coroutine_handle<async_promise<T>>::from_promise(*this));
+}
+
+inline async_task<void> async_promise<void>::get_return_object() noexcept
+{
+    return async_task<void>(std::coroutine_handle<async_promise<void>>::from_promise(*this));
+}
+
+class task_executor;
+
+/**
+ * @brief Resumes the awaiting coroutine on a worker, or on the main thread with
+ * TASK_OPTION_MAIN_THREAD.
+ */
+class task_switch_awaiter
+{
+public:
+    task_switch_awaiter(task_executor* executor, task_option option) noexcept
+        : m_executor(executor),
+          m_resume(option)
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const noexcept {}
+
+protected:
+    task_executor* m_executor;
+    task_resume m_resume;
+};
+
+/**
+ * @brief Resumes the awaiting coroutine when the next frame begins.
+ */
+class task_frame_awaiter : public task_switch_awaiter
+{
+public:
+    using task_switch_awaiter::task_switch_awaiter;
+
+    void await_suspend(std::coroutine_handle<> handle);
+};
+
+/**
+ * @brief Resumes the awaiting coroutine once a point in time has passed.
+ */
+class task_delay_awaiter : public task_switch_awaiter
+{
+public:
+    task_delay_awaiter(
+        task_executor* executor,
+        std::chrono::steady_clock::time_point time,
+        task_option option) noexcept
+        : task_switch_awaiter(executor, option),
+          m_time(time)
+    {
+    }
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+private:
+    friend class async_io;
+
+    std::chrono::steady_clock::time_point m_time;
+};
+
+/**
+ * @brief Reads a whole file on the I/O thread of the executor and resumes the awaiting coroutine
+ * when the data is ready. co_await returns false if the file could not be read.
+ */
+class task_read_awaiter : public task_switch_awaiter
+{
+public:
+    task_read_awaiter(
+        task_executor* executor,
+        std::string_view path,
+        std::vector<std::uint8_t>& data,
+        task_option option)
+        : task_switch_awaiter(executor, option),
+          m_path(path),
+          m_data(data),
+          m_result(false)
+    {
+    }
+
+    void await_suspend(std::coroutine_handle<> handle);
+    bool await_resume() const noexcept { return m_result; }
+
+private:
+    friend class async_io;
+
+    std::string m_path;
+    std::vector<std::uint8_t>& m_data;
+    bool m_result;
+};
+} // namespace violet
\ No newline at end of file
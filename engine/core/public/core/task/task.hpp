@@ -1,9 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
-#include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -20,6 +23,7 @@ struct functor_traits<R(Args...)>
     using argument_type = std::tuple<Args...>;
     using return_type = R;
     using function_type = std::function<R(Args...)>;
+    using signature_type = R(Args...);
 };
 
 template <typename R, typename... Args>
@@ -28,6 +32,7 @@ struct functor_traits<R (*)(Args...)>
     using argument_type = std::tuple<Args...>;
     using return_type = R;
     using function_type = std::function<R(Args...)>;
+    using signature_type = R(Args...);
 };
 
 template <typename R, typename C, typename... Args>
@@ -36,6 +41,7 @@ struct functor_traits<R (C::*)(Args...) const>
     using argument_type = std::tuple<Args...>;
     using return_type = R;
     using function_type = std::function<R(Args...)>;
+    using signature_type = R(Args...);
 };
 
 template <typename R, typename C, typename... Args>
@@ -44,12 +50,23 @@ struct functor_traits<R (C::*)(Args...)>
     using argument_type = std::tuple<Args...>;
     using return_type = R;
     using function_type = std::function<R(Args...)>;
+    using signature_type = R(Args...);
 };
 
 enum task_option : std::uint32_t
 {
     TASK_OPTION_NONE = 0,
-    TASK_OPTION_MAIN_THREAD = 1
+    TASK_OPTION_MAIN_THREAD = 1,
+    TASK_OPTION_BACKGROUND = 2
+};
+
+/**
+ * @brief Half-open range of indices for parallel tasks.
+ */
+struct task_range
+{
+    std::size_t begin;
+    std::size_t end;
 };
 
 class task_graph_base;
@@ -59,32 +76,123 @@ public:
     task_base(task_option option, task_graph_base* graph = nullptr) noexcept;
     virtual ~task_base();
 
-    std::vector<task_base*> execute();
+    /**
+     * @brief Run the task.
+     *
+     * @return task_base* The first task that became ready to run, the others follow through
+     * get_next_ready. The list lives in the tasks, so no memory is allocated.
+     */
+    virtual task_base* execute();
     std::vector<task_base*> visit();
 
+    task_base* get_next_ready() const noexcept { return m_next_ready; }
+    void set_next_ready(task_base* next) noexcept { m_next_ready = next; }
+
     bool is_ready() const noexcept { return m_uncompleted_dependency_count == 0; }
 
     std::size_t get_option() const noexcept { return m_option; }
 
+    /**
+     * @brief Override the priority computed for the task. Ready tasks with a higher priority are
+     * run first.
+     *
+     * @param priority 0 to use the length of the longest path from the task to the end of the graph.
+     */
+    void set_priority(std::uint32_t priority) noexcept;
+    std::uint32_t get_priority() const noexcept { return m_priority; }
+
+    /**
+     * @brief Name the task in profiler traces. The name is not copied, so it should be a string
+     * literal. Does nothing unless VIOLET_TASK_PROFILER is defined.
+     */
+    void set_name([[maybe_unused]] const char* name) noexcept
+    {
+#ifdef VIOLET_TASK_PROFILER
+        m_name = name;
+#endif
+    }
+
+    const char* get_name() const noexcept
+    {
+#ifdef VIOLET_TASK_PROFILER
+        return m_name;
+#else
+        return nullptr;
+#endif
+    }
+
 protected:
     void add_successor(task_base* successor);
 
+    /**
+     * @brief Signal the successors and the graph that the task has finished.
+     *
+     * @return task_base* Successors whose dependencies are all complete, linked like the result of
+     * execute.
+     */
+    task_base* complete();
+
     task_graph_base* get_graph() const noexcept { return m_graph; }
 
 private:
     friend class task_graph_base;
+    friend class task_executor;
 
     virtual void execute_impl() {}
 
+    /**
+     * @brief Compute the priority from the successors, which must be up to date, and sort the
+     * successors so the ones with higher priority become ready first.
+     */
+    void update_priority();
+
     std::vector<task_base*> m_dependents;
     std::vector<task_base*> m_successors;
 
     std::atomic<std::uint32_t> m_uncompleted_dependency_count;
 
+    // Link in the list of ready tasks returned by execute. A task becomes ready once per execution,
+    // so the link is free to reuse.
+    task_base* m_next_ready;
+
     task_option m_option;
     task_graph_base* m_graph;
+
+    std::uint32_t m_priority;
+    std::uint32_t m_manual_priority;
+
+#ifdef VIOLET_TASK_PROFILER
+    const char* m_name{nullptr};
+
+    // Set when the task is handed to the executor, to measure how long it waits in a queue.
+    std::int64_t m_queue_time{0};
+#endif
 };
 
+/**
+ * @brief Waits for an execution of a task graph. Unlike std::future it holds no state of its own,
+ * the graph counts its incomplete tasks and the counter is reused by the next execution.
+ */
+class task_future
+{
+public:
+    task_future(task_graph_base* graph = nullptr) noexcept : m_graph(graph) {}
+
+    /**
+     * @brief Block until the execution is complete. Main thread tasks are not run meanwhile, so a
+     * thread outside the pool should wait with task_executor::wait if the graph has any.
+     */
+    void wait() const;
+    void get() const { wait(); }
+
+private:
+    friend class task_executor;
+
+    task_graph_base* m_graph;
+};
+
+class task_executor;
+
 class task_graph_base
 {
 public:
@@ -105,47 +213,52 @@ public:
         return result;
     }
 
-    std::future<void> reset(task_base* root) noexcept;
+    task_future reset(task_base* root) noexcept;
     void on_task_complete();
 
+    /**
+     * @brief Block until the tasks of the current execution are complete. Waits on the epoch of
+     * the executor, since the last task must not touch the graph after completing it.
+     */
+    void wait() const;
+
+    bool is_complete() const noexcept { return m_incomplete_count.load() == 0; }
+
     std::size_t get_task_count(int option) const noexcept;
 
 protected:
     bool is_dirty() const noexcept { return m_dirty; }
 
 private:
+    friend class task_base;
+    friend class task_executor;
+
+    // The executor running the graph, notified when an execution completes.
+    task_executor* m_executor;
+
     std::vector<std::unique_ptr<task_base>> m_tasks;
     bool m_dirty;
 
     std::vector<task_base*> m_accessible_tasks;
     std::atomic<std::uint32_t> m_incomplete_count;
 
-    std::promise<void> m_promise;
-
     std::mutex m_lock;
 };
 
-template <typename T>
+template <typename Functor, typename Signature>
 class task_node;
 
-template <typename... Args>
+template <typename F>
 struct next_task
 {
+    using type = task_node<F, typename functor_traits<F>::signature_type>;
 };
 
-template <typename R, typename... Args>
-struct next_task<R, std::tuple<Args...>>
-{
-    using type = task_node<R(Args...)>;
-};
+template <typename Functor>
+class task_parallel_for;
 
-template <typename F>
-struct next_task<F>
-{
-    using type = typename next_task<
-        typename functor_traits<F>::return_type,
-        typename functor_traits<F>::argument_type>::type;
-};
+template <typename T, typename Functor, typename Reduce>
+class task_parallel_reduce;
 
 template <typename... Args>
 class task : public task_base
@@ -166,19 +279,65 @@ public:
         return task;
     }
 
-    result_type& get_result() { return *m_result; }
+    /**
+     * @brief Run the functor for every index of the range, split into slices of grain indices
+     * that run on different threads. Successors run after all slices finished.
+     *
+     * @param grain Indices per slice, 0 splits the range into a few slices per hardware thread.
+     * @param functor void(std::size_t index)
+     */
+    template <typename Functor>
+    task<>& then_parallel_for(
+        task_range range,
+        std::size_t grain,
+        Functor functor,
+        task_option option = TASK_OPTION_NONE)
+    {
+        auto& task = get_graph()->add_task<task_parallel_for<Functor>>(
+            range,
+            grain,
+            functor,
+            option);
+        add_successor(&task);
+        return task;
+    }
 
-protected:
-    void set_result(result_type&& result)
+    /**
+     * @brief Like then_parallel_for, but map each index to a value and combine the values. The
+     * values of each slice and then the slices are combined in index order.
+     *
+     * @param functor T(std::size_t index)
+     * @param reduce T(T, T)
+     * @return task<T>& A task whose successors receive the combined value.
+     */
+    template <typename T, typename Functor, typename Reduce>
+    task<T>& then_parallel_reduce(
+        task_range range,
+        std::size_t grain,
+        T identity,
+        Functor functor,
+        Reduce reduce,
+        task_option option = TASK_OPTION_NONE)
     {
-        if (m_result)
-            *m_result = result;
-        else
-            m_result = std::make_unique<result_type>(result);
+        auto& task = get_graph()->add_task<task_parallel_reduce<T, Functor, Reduce>>(
+            range,
+            grain,
+            identity,
+            functor,
+            reduce,
+            option);
+        add_successor(&task);
+        return task;
     }
 
+    result_type& get_result() { return *m_result; }
+
+protected:
+    void set_result(result_type&& result) { m_result.emplace(std::move(result)); }
+
 private:
-    std::unique_ptr<result_type> m_result;
+    // Stored in place, so setting the result of each execution does not allocate.
+    std::optional<result_type> m_result;
 };
 
 template <>
@@ -196,6 +355,57 @@ public:
         add_successor(&task);
         return task;
     }
+
+    /**
+     * @brief Run the functor for every index of the range, split into slices of grain indices
+     * that run on different threads. Successors run after all slices finished.
+     *
+     * @param grain Indices per slice, 0 splits the range into a few slices per hardware thread.
+     * @param functor void(std::size_t index)
+     */
+    template <typename Functor>
+    task<>& then_parallel_for(
+        task_range range,
+        std::size_t grain,
+        Functor functor,
+        task_option option = TASK_OPTION_NONE)
+    {
+        auto& task = get_graph()->add_task<task_parallel_for<Functor>>(
+            range,
+            grain,
+            functor,
+            option);
+        add_successor(&task);
+        return task;
+    }
+
+    /**
+     * @brief Like then_parallel_for, but map each index to a value and combine the values. The
+     * values of each slice and then the slices are combined in index order.
+     *
+     * @param functor T(std::size_t index)
+     * @param reduce T(T, T)
+     * @return task<T>& A task whose successors receive the combined value.
+     */
+    template <typename T, typename Functor, typename Reduce>
+    task<T>& then_parallel_reduce(
+        task_range range,
+        std::size_t grain,
+        T identity,
+        Functor functor,
+        Reduce reduce,
+        task_option option = TASK_OPTION_NONE)
+    {
+        auto& task = get_graph()->add_task<task_parallel_reduce<T, Functor, Reduce>>(
+            range,
+            grain,
+            identity,
+            functor,
+            reduce,
+            option);
+        add_successor(&task);
+        return task;
+    }
 };
 
 template <typename T>
@@ -217,15 +427,18 @@ struct task_impl_traits<void>
     static constexpr bool has_result = false;
 };
 
-template <typename R, typename... Args>
-class task_node<R(Args...)> : public task_impl_traits<R>::type
+/**
+ * @brief Task that calls a functor with the result of the previous task. The functor is stored by
+ * value, so calling it needs neither type erasure nor an allocation.
+ */
+template <typename Functor, typename R, typename... Args>
+class task_node<Functor, R(Args...)> : public task_impl_traits<R>::type
 {
 public:
     using prev_task_type = task<Args...>;
     using base_type = typename task_impl_traits<R>::type;
 
 public:
-    template <typename Functor>
     task_node(Functor functor, prev_task_type* prev_task, task_option option = TASK_OPTION_NONE)
         : base_type(option),
           m_callable(functor),
@@ -252,10 +465,164 @@ private:
         }
     }
 
-    std::function<R(Args...)> m_callable;
+    Functor m_callable;
     prev_task_type* m_prev_task;
 };
 
+/**
+ * @brief Base of tasks that split a range into slices. The slices are handed to the executor as
+ * separate tasks, and the last slice to finish completes the task.
+ */
+template <typename Base>
+class task_split : public Base
+{
+public:
+    task_split(task_range range, std::size_t grain, task_option option) : Base(option)
+    {
+        std::size_t size = range.end > range.begin ? range.end - range.begin : 0;
+        if (grain == 0)
+        {
+            std::size_t thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+            grain = std::max(size / (thread_count * 4), static_cast<std::size_t>(1));
+        }
+
+        for (std::size_t begin = range.begin; begin < range.end; begin += grain)
+        {
+            m_slices.push_back(std::make_unique<slice>(
+                this,
+                m_slices.size(),
+                task_range{begin, std::min(begin + grain, range.end)}));
+        }
+    }
+
+    virtual task_base* execute() override
+    {
+        if (m_slices.empty())
+        {
+            on_slices_complete();
+            return task_base::complete();
+        }
+
+        m_remaining_count.store(m_slices.size(), std::memory_order_relaxed);
+
+        for (std::size_t i = 0; i + 1 < m_slices.size(); ++i)
+            m_slices[i]->set_next_ready(m_slices[i + 1].get());
+        m_slices.back()->set_next_ready(nullptr);
+
+#ifdef VIOLET_TASK_PROFILER
+        for (auto& slice : m_slices)
+            slice->set_name(this->get_name());
+#endif
+
+        return m_slices.front().get();
+    }
+
+protected:
+    std::size_t get_slice_count() const noexcept { return m_slices.size(); }
+
+private:
+    class slice : public task_base
+    {
+    public:
+        slice(task_split* owner, std::size_t index, task_range range) noexcept
+            : task_base(TASK_OPTION_NONE),
+              m_owner(owner),
+              m_index(index),
+              m_range(range)
+        {
+        }
+
+        virtual task_base* execute() override
+        {
+            m_owner->execute_slice(m_index, m_range);
+
+            if (m_owner->m_remaining_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return nullptr;
+
+            m_owner->on_slices_complete();
+            return m_owner->complete();
+        }
+
+    private:
+        task_split* m_owner;
+        std::size_t m_index;
+        task_range m_range;
+    };
+
+    virtual void execute_slice(std::size_t index, task_range range) = 0;
+    virtual void on_slices_complete() {}
+
+    std::vector<std::unique_ptr<slice>> m_slices;
+    std::atomic<std::size_t> m_remaining_count{0};
+};
+
+template <typename Functor>
+class task_parallel_for : public task_split<task<>>
+{
+public:
+    task_parallel_for(
+        task_range range,
+        std::size_t grain,
+        Functor functor,
+        task_option option = TASK_OPTION_NONE)
+        : task_split<task<>>(range, grain, option),
+          m_functor(functor)
+    {
+    }
+
+private:
+    virtual void execute_slice(std::size_t, task_range range) override
+    {
+        for (std::size_t i = range.begin; i < range.end; ++i)
+            m_functor(i);
+    }
+
+    Functor m_functor;
+};
+
+template <typename T, typename Functor, typename Reduce>
+class task_parallel_reduce : public task_split<task<T>>
+{
+public:
+    task_parallel_reduce(
+        task_range range,
+        std::size_t grain,
+        T identity,
+        Functor functor,
+        Reduce reduce,
+        task_option option = TASK_OPTION_NONE)
+        : task_split<task<T>>(range, grain, option),
+          m_identity(identity),
+          m_functor(functor),
+          m_reduce(reduce),
+          m_partials(this->get_slice_count(), identity)
+    {
+    }
+
+private:
+    virtual void execute_slice(std::size_t index, task_range range) override
+    {
+        T value = m_identity;
+        for (std::size_t i = range.begin; i < range.end; ++i)
+            value = m_reduce(value, m_functor(i));
+        m_partials[index] = value;
+    }
+
+    virtual void on_slices_complete() override
+    {
+        T value = m_identity;
+        for (const T& partial : m_partials)
+            value = m_reduce(value, partial);
+        this->set_result(std::make_tuple(value));
+    }
+
+    T m_identity;
+    Functor m_functor;
+    Reduce m_reduce;
+
+    std::vector<T> m_partials;
+};
+
 template <typename... Args>
 class task_graph : public task_graph_base
 {
@@ -290,7 +657,7 @@ public:
 
     task<Args...>& get_root() noexcept { return m_root; }
 
-    std::future<void> reset() noexcept { return task_graph_base::reset(&m_root); }
+    task_future reset() noexcept { return task_graph_base::reset(&m_root); }
 
 private:
     task_root m_root;
@@ -1,10 +1,28 @@
 #pragma once
 
-#include "core/task/task.hpp"
+#include "core/task/async_task.hpp"
 
 namespace violet
 {
+class async_io;
 class task_queue;
+
+struct task_pool_desc
+{
+    std::string name;
+
+    // 0 for one thread per processor of the NUMA node, or of the machine.
+    std::size_t thread_count{0};
+
+    // NUMA node the threads run on, -1 for any node.
+    int numa_node{-1};
+
+    // Pin each thread to one processor of the node, in order from the first processor, so pools
+    // sharing a node can be given processors of their own.
+    bool pin{false};
+    std::size_t first_processor{0};
+};
+
 class task_executor
 {
 public:
@@ -12,48 +30,147 @@ public:
     ~task_executor();
 
     template <typename G, typename... Args>
-    std::future<void> execute(G& graph, Args&&... args)
+    task_future execute(G& graph, Args&&... args)
     {
-        std::future<void> future = graph.reset();
+        task_future future = graph.reset();
         if (graph.get_task_count(TASK_OPTION_NONE) > 1)
         {
             graph.set_argument(std::forward<Args>(args)...);
+            graph.m_executor = this;
             execute_task(&graph.get_root());
 
-            std::size_t main_thread_task_count = graph.get_task_count(TASK_OPTION_MAIN_THREAD);
-            execute_main_thread_task(main_thread_task_count);
+            return future;
         }
 
-        return future;
+        return task_future();
     }
 
     template <typename G, typename... Args>
     void execute_sync(G& graph, Args&&... args)
     {
-        std::future<void> future = graph.reset();
-        if (graph.get_task_count(TASK_OPTION_NONE) > 1)
-        {
-            graph.set_argument(std::forward<Args>(args)...);
-            execute_task(&graph.get_root());
+        wait(execute(graph, std::forward<Args>(args)...));
+    }
 
-            std::size_t main_thread_task_count = graph.get_task_count(TASK_OPTION_MAIN_THREAD);
-            execute_main_thread_task(main_thread_task_count);
-            future.get();
-        }
+    /**
+     * @brief Run tasks on the calling thread until the execution is complete. A thread outside the
+     * pool runs the main thread tasks first, then helps with the other tasks.
+     */
+    void wait(const task_future& future);
+
+    /**
+     * @brief Start a coroutine on a worker, or on the main thread with TASK_OPTION_MAIN_THREAD.
+     */
+    template <typename T>
+    void schedule(async_task<T>& task, task_option option = TASK_OPTION_NONE)
+    {
+        execute_task(&task.start(option));
     }
 
+    task_switch_awaiter switch_to(task_option option) { return task_switch_awaiter(this, option); }
+
+    task_frame_awaiter next_frame(task_option option = TASK_OPTION_NONE)
+    {
+        return task_frame_awaiter(this, option);
+    }
+
+    task_delay_awaiter delay(
+        std::chrono::steady_clock::duration duration,
+        task_option option = TASK_OPTION_NONE)
+    {
+        return task_delay_awaiter(this, std::chrono::steady_clock::now() + duration, option);
+    }
+
+    task_read_awaiter read_file(
+        std::string_view path,
+        std::vector<std::uint8_t>& data,
+        task_option option = TASK_OPTION_NONE)
+    {
+        return task_read_awaiter(this, path, data, option);
+    }
+
+    /**
+     * @brief Resume the coroutines waiting for the next frame, and run the coroutines that were
+     * resumed on the main thread. Called by the main thread between frames.
+     */
+    void begin_frame();
+
+    /**
+     * @brief Run a single pool of workers that may run on any processor.
+     */
     void run(std::size_t thread_count = 0);
+
+    /**
+     * @brief Run a pool of workers per description. Tasks run in the first pool, except tasks with
+     * TASK_OPTION_BACKGROUND, which run in the pool named "background" when there is one. Workers
+     * only steal from their own pool, so background work never takes the threads of frame work.
+     */
+    void run(const std::vector<task_pool_desc>& pools);
     void stop();
 
+    /**
+     * @brief Number of workers of the first pool.
+     */
+    std::size_t get_thread_count() const noexcept;
+
 private:
+    friend class task_graph_base;
+    friend class task_switch_awaiter;
+    friend class task_frame_awaiter;
+    friend class task_delay_awaiter;
+    friend class task_read_awaiter;
+
     class thread_pool;
+    class worker;
 
     void execute_task(task_base* task);
-    void execute_main_thread_task(std::size_t task_count);
 
-    std::unique_ptr<task_queue> m_queue;
+    /**
+     * @brief Queue the tasks of a list returned by task_base::execute.
+     */
+    void execute_ready_task(task_base* first);
+
+    /**
+     * @brief Execute a task, recording it when the profiler is enabled.
+     */
+    task_base* run_task(task_base* task);
+
+    void run_worker(worker& worker);
+
+    /**
+     * @brief Look for a task in the local queue of the worker, the shared queue of its pool and the
+     * queues of the other workers of its pool.
+     *
+     * @param worker The calling worker, nullptr on threads outside the pools, which help the first
+     * pool.
+     */
+    task_base* find_task(worker* worker);
+    task_base* wait_task(worker& worker);
+    void wake_worker(thread_pool& pool);
+
+    /**
+     * @brief Wake the threads waiting in wait, called when a graph execution completes.
+     */
+    void notify_complete();
+
+    // The worker running on the calling thread, nullptr on threads outside the pools.
+    static worker*& get_current_worker() noexcept;
+
     std::unique_ptr<task_queue> m_main_thread_queue;
-    std::unique_ptr<thread_pool> m_thread_pool;
+
+    // The first pool runs tasks without a pool of their own.
+    std::vector<std::unique_ptr<thread_pool>> m_pools;
+    thread_pool* m_background_pool;
+
+    // Coroutines waiting for the next frame.
+    std::vector<task_base*> m_frame_waiters;
+    std::mutex m_frame_lock;
+
+    // Timers and file reads of coroutines.
+    std::unique_ptr<async_io> m_io;
+
+    // Threads in wait park on the wait epoch, which is bumped when a main thread task is pushed or a
+    // graph execution completes.
+    std::atomic<std::uint32_t> m_wait_epoch;
 
     std::atomic<bool> m_stop;
 };
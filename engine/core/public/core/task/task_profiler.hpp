@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace violet
+{
+enum task_event_type : std::uint32_t
+{
+    TASK_EVENT_TYPE_EXECUTE,
+    TASK_EVENT_TYPE_STEAL
+};
+
+struct task_event
+{
+    task_event_type type;
+
+    // Worker the task was stolen from, only used by steal events.
+    std::uint32_t victim;
+
+    const char* name;
+
+    // Nanoseconds since the epoch of the steady clock.
+    std::int64_t queue_time;
+    std::int64_t begin_time;
+    std::int64_t end_time;
+};
+
+/**
+ * @brief Records task events into a lock-free ring buffer per thread, and exports the last frames
+ * as Chrome trace events. The executor only records events when VIOLET_TASK_PROFILER is defined.
+ */
+class task_profiler
+{
+public:
+    static task_profiler& get();
+
+    static std::int64_t now() noexcept;
+
+    /**
+     * @brief Mark the start of a frame, events of the last frames can be dumped.
+     */
+    void begin_frame();
+
+    /**
+     * @brief Name the calling thread in the trace.
+     */
+    void set_thread_name(std::string_view name);
+
+    /**
+     * @brief Allocate the buffer of a thread ahead of time, so the thread never allocates when it
+     * records its first event. The thread takes the buffer with attach_thread.
+     *
+     * @return The id of the buffer.
+     */
+    std::uint32_t register_thread(std::string_view name);
+    void attach_thread(std::uint32_t id);
+
+    void record_execute(
+        const char* name,
+        std::int64_t queue_time,
+        std::int64_t begin_time,
+        std::int64_t end_time);
+    void record_steal(const char* name, std::uint32_t victim);
+
+    /**
+     * @brief Export the events of the last frames in the Chrome trace event format, which can be
+     * opened in chrome://tracing or Perfetto.
+     *
+     * @param frame_count Number of frames, the current frame included. 0 exports every event still
+     * in the buffers.
+     */
+    std::string dump(std::size_t frame_count) const;
+
+private:
+    static constexpr std::size_t EVENT_CAPACITY = 1 << 14;
+    static constexpr std::size_t FRAME_CAPACITY = 256;
+
+    struct thread_buffer
+    {
+        std::uint32_t id;
+        std::string name;
+
+        std::unique_ptr<task_event[]> events;
+
+        // Only written by the owner thread. A reader copies the events and then drops the ones the
+        // owner may have overwritten meanwhile.
+        std::atomic<std::uint64_t> head;
+    };
+
+    task_profiler() = default;
+
+    static thread_buffer*& get_current_buffer() noexcept;
+
+    thread_buffer& create_thread_buffer();
+    thread_buffer& get_thread_buffer();
+    void record(const task_event& event);
+
+    std::vector<std::unique_ptr<thread_buffer>> m_buffers;
+    mutable std::mutex m_lock;
+
+    std::atomic<std::int64_t> m_frames[FRAME_CAPACITY] = {};
+    std::atomic<std::uint64_t> m_frame_count{0};
+};
+} // namespace violet
\ No newline at end of file
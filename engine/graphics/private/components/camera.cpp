@@ -149,6 +149,27 @@ void camera::resize(std::uint32_t width, std::uint32_t height)
     m_framebuffer_cache.clear();
 }
 
+camera_render_data camera::get_render_data(const float4x4& view) const
+{
+    camera_render_data result = {};
+    result.render_pass = m_render_pass;
+    result.scissor = m_scissor;
+    result.viewport = m_viewport;
+    result.parameter = m_parameter;
+
+    result.parameter_data.view = view;
+    result.parameter_data.projection = m_parameter_data.projection;
+
+    float4x4_simd v = simd::load(view);
+    float4x4_simd p = simd::load(m_parameter_data.projection);
+    simd::store(matrix_simd::mul(v, p), result.parameter_data.view_projection);
+
+    result.attachments = m_attachments;
+    result.back_buffer_index = m_back_buffer_index;
+
+    return result;
+}
+
 camera& camera::operator=(camera&& other) noexcept
 {
     m_perspective = other.m_perspective;
@@ -2,6 +2,7 @@
 #include "components/camera.hpp"
 #include "components/mesh.hpp"
 #include "components/transform.hpp"
+#include "common/hash.hpp"
 #include "rhi_plugin.hpp"
 #include "window/window_system.hpp"
 
@@ -26,12 +27,18 @@ private:
     rhi_parameter_layout* m_mesh_parameter_layout;
 };
 
-graphics_system::graphics_system() : engine_system("graphics"), m_idle(false)
+graphics_system::graphics_system()
+    : engine_system("graphics"),
+      m_extract_count(0),
+      m_transform_version(0)
 {
 }
 
 graphics_system::~graphics_system()
 {
+    for (auto& [hash, framebuffer] : m_framebuffers)
+        m_plugin->get_rhi()->destroy_framebuffer(framebuffer);
+
     m_context = nullptr;
     m_plugin->unload();
 }
@@ -54,11 +61,6 @@ bool graphics_system::initialize(const dictionary& config)
 
     m_context = std::make_unique<graphics_context>(m_plugin->get_rhi());
 
-    window.on_tick().then(
-        [this]()
-        {
-            begin_frame();
-        });
     window.on_resize().then(
         [this](std::uint32_t width, std::uint32_t height)
         {
@@ -67,7 +69,12 @@ bool graphics_system::initialize(const dictionary& config)
     on_frame_end().then(
         [this]()
         {
-            end_frame();
+            extract();
+        });
+    on_render().then(
+        [this](std::size_t frame_index)
+        {
+            render(frame_index);
         });
 
     get_world().register_component<mesh, mesh_component_info>(
@@ -87,63 +94,114 @@ void graphics_system::render(render_graph* graph)
     m_render_graphs.push_back(graph);
 }
 
-void graphics_system::begin_frame()
+void graphics_system::extract()
 {
-    if (!m_idle)
-        m_context->get_rhi()->begin_frame();
-}
+    render_frame& frame = m_frames[m_extract_count % 2];
 
-void graphics_system::end_frame()
-{
-    render();
+    frame.render_graphs.swap(m_render_graphs);
+    m_render_graphs.clear();
+
+    frame.cameras.clear();
+    frame.model_matrices.clear();
+    frame.meshes.clear();
+
+    if (!frame.render_graphs.empty())
+        extract(frame);
+
+    ++m_extract_count;
 }
 
-void graphics_system::render()
+void graphics_system::extract(render_frame& frame)
 {
-    m_idle = m_render_graphs.empty();
-    if (m_idle)
-        return;
-
-    view<camera, transform> camera_view(get_world());
+    view<const camera, const transform> camera_view(get_world());
     camera_view.each(
-        [this](camera& camera, transform& transform)
+        [&frame](const camera& camera, const transform& transform)
         {
-            camera.set_view(matrix::inverse(transform.get_world_matrix()));
-            camera.set_back_buffer(m_context->get_rhi()->get_back_buffer());
-
-            render_pass* render_pass = camera.get_render_pass();
-            render_pass->add_camera(
-                camera.get_scissor(),
-                camera.get_viewport(),
-                camera.get_parameter(),
-                camera.get_framebuffer());
+            frame.cameras.push_back(
+                camera.get_render_data(matrix::inverse(transform.get_world_matrix())));
         });
 
-    view<mesh, transform> mesh_view(get_world());
+    view<const mesh, const transform> mesh_view(get_world());
+    mesh_view.each_changed<const transform>(
+        m_transform_version,
+        [&frame](const mesh& mesh, const transform& transform)
+        {
+            frame.model_matrices.emplace_back(mesh.get_parameter(), transform.get_world_matrix());
+        });
     mesh_view.each(
-        [](mesh& mesh, transform& transform)
+        [&frame](const mesh& mesh, const transform& transform)
         {
-            // if (transform.get_update_count() != 0)
-            mesh.set_model_matrix(transform.get_world_matrix());
             mesh.each_submesh(
-                [](const render_mesh& submesh, render_pipeline* pipeline)
+                [&frame](const render_mesh& submesh, render_pipeline* pipeline)
                 {
-                    pipeline->add_mesh(submesh);
+                    frame.meshes.emplace_back(submesh, pipeline);
                 });
         });
+}
+
+void graphics_system::render(std::size_t frame_index)
+{
+    // In pipelined mode this runs while the next frame is extracted into the other frame.
+    const render_frame& frame = m_frames[frame_index % 2];
+
+    if (frame.render_graphs.empty())
+        return;
+
+    rhi_renderer* rhi = m_context->get_rhi();
+    rhi->begin_frame();
+
+    for (const camera_render_data& camera : frame.cameras)
+    {
+        camera.parameter->set_uniform(0, &camera.parameter_data, sizeof(camera_parameter), 0);
+        camera.render_pass->add_camera(
+            camera.scissor,
+            camera.viewport,
+            camera.parameter,
+            get_framebuffer(camera, rhi->get_back_buffer()));
+    }
+
+    for (auto& [parameter, model] : frame.model_matrices)
+        parameter->set_uniform(0, &model, sizeof(float4x4), 0);
+
+    for (auto& [submesh, pipeline] : frame.meshes)
+        pipeline->add_mesh(submesh);
 
     std::vector<rhi_semaphore*> render_finished_semaphores;
-    render_finished_semaphores.reserve(m_render_graphs.size());
-    for (render_graph* render_graph : m_render_graphs)
+    render_finished_semaphores.reserve(frame.render_graphs.size());
+    for (render_graph* render_graph : frame.render_graphs)
     {
         render_graph->execute();
         render_finished_semaphores.push_back(render_graph->get_render_finished_semaphore());
     }
-    m_render_graphs.clear();
 
-    m_context->get_rhi()->present(
-        render_finished_semaphores.data(),
-        render_finished_semaphores.size());
-    m_context->get_rhi()->end_frame();
+    rhi->present(render_finished_semaphores.data(), render_finished_semaphores.size());
+    rhi->end_frame();
+}
+
+rhi_framebuffer* graphics_system::get_framebuffer(
+    const camera_render_data& camera,
+    rhi_resource* back_buffer)
+{
+    std::size_t hash = std::hash<rhi_render_pass*>()(camera.render_pass->get_interface());
+    for (std::size_t i = 0; i < camera.attachments.size(); ++i)
+    {
+        rhi_resource* attachment =
+            i == camera.back_buffer_index ? back_buffer : camera.attachments[i];
+        hash = hash_combine(hash, attachment->get_hash());
+    }
+
+    auto iter = m_framebuffers.find(hash);
+    if (iter != m_framebuffers.end())
+        return iter->second;
+
+    rhi_framebuffer_desc desc = {};
+    desc.render_pass = camera.render_pass->get_interface();
+    for (std::size_t i = 0; i < camera.attachments.size(); ++i)
+        desc.attachments[i] = i == camera.back_buffer_index ? back_buffer : camera.attachments[i];
+    desc.attachment_count = camera.attachments.size();
+
+    rhi_framebuffer* framebuffer = m_context->get_rhi()->create_framebuffer(desc);
+    m_framebuffers[hash] = framebuffer;
+    return framebuffer;
 }
 } // namespace violet
\ No newline at end of file
@@ -17,6 +17,25 @@ struct camera_parameter
     float4x4 view_projection;
 };
 
+/**
+ * @brief State of a camera read by the render stage. It is copied when a frame is extracted, so the
+ * camera can change while the frame is rendered.
+ */
+struct camera_render_data
+{
+    render_pass* render_pass;
+
+    rhi_scissor_rect scissor;
+    rhi_viewport viewport;
+
+    rhi_parameter* parameter;
+    camera_parameter parameter_data;
+
+    // The attachment at the back buffer index is replaced by the back buffer of the frame.
+    std::vector<rhi_resource*> attachments;
+    std::size_t back_buffer_index;
+};
+
 class camera
 {
 public:
@@ -43,6 +62,11 @@ public:
 
     void resize(std::uint32_t width, std::uint32_t height);
 
+    /**
+     * @brief Copy the state used to render the camera from the view.
+     */
+    camera_render_data get_render_data(const float4x4& view) const;
+
     camera& operator=(const camera&) = delete;
     camera& operator=(camera&& other) noexcept;
 
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "components/camera.hpp"
 #include "core/engine_system.hpp"
 #include "graphics/render_graph/render_graph.hpp"
+#include "graphics/render_graph/render_pipeline.hpp"
 #include "graphics/render_interface.hpp"
+#include <unordered_map>
 
 namespace violet
 {
@@ -21,15 +24,42 @@ public:
     graphics_context* get_context() const noexcept { return m_context.get(); }
 
 private:
-    void begin_frame();
-    void end_frame();
-    void render();
+    /**
+     * @brief Data read by the render stage. It is double buffered, so the render stage of a frame
+     * can run while the next frame is extracted.
+     *
+     * In pipelined mode the render stage runs during tick, so the frame holds copies of the
+     * components it needs instead of pointers to them.
+     */
+    struct render_frame
+    {
+        std::vector<render_graph*> render_graphs;
+        std::vector<camera_render_data> cameras;
+        std::vector<std::pair<rhi_parameter*, float4x4>> model_matrices;
+        std::vector<std::pair<render_mesh, render_pipeline*>> meshes;
+    };
+
+    void extract();
+    void extract(render_frame& frame);
+    void render(std::size_t frame_index);
+
+    /**
+     * @brief Get the framebuffer of the camera for the back buffer of the frame. Only called by the
+     * render stage, which owns the cache.
+     */
+    rhi_framebuffer* get_framebuffer(const camera_render_data& camera, rhi_resource* back_buffer);
 
     std::vector<render_graph*> m_render_graphs;
 
     std::unique_ptr<graphics_context> m_context;
     std::unique_ptr<rhi_plugin> m_plugin;
 
-    bool m_idle;
+    // Frame n is extracted into m_frames[n % 2].
+    render_frame m_frames[2];
+    std::size_t m_extract_count;
+
+    std::unordered_map<std::size_t, rhi_framebuffer*> m_framebuffers;
+
+    std::uint32_t m_transform_version;
 };
 } // namespace violet
\ No newline at end of file
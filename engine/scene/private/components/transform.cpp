@@ -134,7 +134,7 @@ void transform::set_world_matrix(const float4x4& matrix)
     if (m_parent)
     {
         m_local_matrix =
-            matrix::mul(matrix, matrix::inverse_transform(m_parent->get_world_matrix()));
+            matrix::mul(matrix, matrix::inverse_transform(m_parent.read()->get_world_matrix()));
     }
     else
     {
@@ -150,7 +150,7 @@ void transform::set_world_matrix(const float4x4_simd& matrix)
 {
     if (m_parent)
     {
-        float4x4_simd parent_to_world = simd::load(m_parent->get_world_matrix());
+        float4x4_simd parent_to_world = simd::load(m_parent.read()->get_world_matrix());
         simd::store(
             matrix_simd::mul(matrix, matrix_simd::inverse_transform(parent_to_world)),
             m_local_matrix);
@@ -179,7 +179,7 @@ const float4x4& transform::get_world_matrix() const noexcept
         do
         {
             path.push_back(node);
-            node = node->m_parent.get();
+            node = node->m_parent.read();
         } while (node->m_world_dirty);
 
         for (auto iter = path.rbegin(); iter != path.rend(); ++iter)
@@ -187,7 +187,7 @@ const float4x4& transform::get_world_matrix() const noexcept
             simd::store(
                 matrix_simd::mul(
                     simd::load((*iter)->m_local_matrix),
-                    simd::load((*iter)->m_parent->m_world_matrix)),
+                    simd::load((*iter)->m_parent.read()->m_world_matrix)),
                 (*iter)->m_world_matrix);
 
             (*iter)->m_world_dirty = false;
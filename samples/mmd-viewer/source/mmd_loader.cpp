@@ -169,14 +169,15 @@ void mmd_loader::load_bones(mmd_model* model, const pmx& pmx, world& world)
     auto model_skeleton = model->model->get<mmd_skeleton>();
     model_skeleton->bones.resize(pmx.bones.size());
 
-    model->bones.reserve(pmx.bones.size());
+    std::vector<std::string_view> bone_names;
+    bone_names.reserve(pmx.bones.size());
+    for (auto& pmx_bone : pmx.bones)
+        bone_names.push_back(pmx_bone.name_jp);
+
+    model->bones = actor::create_batch<transform>(bone_names, world);
     for (std::size_t i = 0; i < pmx.bones.size(); ++i)
     {
-        auto bone = std::make_unique<actor>(pmx.bones[i].name_jp, world);
-        auto [bone_transform] = bone->add<transform>();
-
-        model->bones.push_back(std::move(bone));
-        model_skeleton->bones[i].transform = bone_transform;
+        model_skeleton->bones[i].transform = model->bones[i]->get<transform>();
         model_skeleton->bones[i].index = static_cast<std::uint32_t>(i);
     }
 
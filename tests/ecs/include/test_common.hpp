@@ -1,7 +1,7 @@
 #pragma once
 
-#include "core/node/node.hpp"
-#include <catch2/catch_test_macros.hpp>
+#include "core/ecs/actor.hpp"
+#include <catch2/catch_all.hpp>
 
 namespace violet::test
 {
@@ -75,5 +75,8 @@ private:
     static inline int m_assignment{0};
     static inline int m_move_assignment{0};
     static inline int m_destruct{0};
+
+    // Empty components are tags, which are never constructed.
+    int m_value{0};
 };
 } // namespace violet::test
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "test_common.hpp"
+
+namespace violet::test
+{
+TEST_CASE("component handle", "[actor]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<rotation>();
+
+    actor a1("test_actor", world);
+
+    a1.add<position>();
+
+    component_ptr<position> handle = a1.get<position>();
+    handle->x = 10;
+
+    a1.add<rotation>();
+    CHECK(handle->x == 10);
+
+    a1.remove<position>();
+    CHECK(!handle);
+}
+
+TEST_CASE("component handle cache", "[actor]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<rotation>();
+
+    std::vector<std::unique_ptr<actor>> actors;
+    for (int i = 0; i < 10; ++i)
+    {
+        actors.push_back(std::make_unique<actor>("test_actor", world));
+        actors.back()->add<position>();
+        actors.back()->get<position>()->x = i;
+    }
+
+    component_ptr<position> handle = actors.back()->get<position>();
+    CHECK(handle->x == 9);
+
+    // Removing an entity moves the last entity of the archetype into the gap.
+    actors.front().reset();
+    CHECK(handle->x == 9);
+
+    world.sort<position>(
+        [](const position& position)
+        {
+            return -position.x;
+        });
+    CHECK(handle->x == 9);
+
+    actors.back()->add<rotation>();
+    CHECK(handle->x == 9);
+
+    // Writes through the cached pointer are still seen by change detection.
+    view<const position> view(world);
+    std::uint32_t version = 0;
+    auto count_changed = [&]()
+    {
+        std::size_t count = 0;
+        view.each_changed<const position>(
+            version,
+            [&count](const position&)
+            {
+                ++count;
+            });
+        return count;
+    };
+    CHECK(count_changed() == 9);
+    CHECK(count_changed() == 0);
+
+    CHECK(handle.read()->x == 9);
+    CHECK(count_changed() == 0);
+
+    handle->x = 20;
+    CHECK(count_changed() == 1);
+    CHECK(actors.back()->get<position>().read()->x == 20);
+}
+} // namespace violet::test
\ No newline at end of file
@@ -34,35 +34,37 @@ TEST_CASE("Iterating entities", "[benchmark]")
 {
     timer timer;
     world world;
+    world.register_component<position>();
 
     for (std::size_t i = 0; i < 1000000; ++i)
     {
         const auto entity = world.create(nullptr);
-        world.add<position>(entity);
+        world.add_component<position>(entity);
     }
 
     timer.start();
-    view<node*, position> view_with_node(world);
-    view_with_node.each([](node* node, position& position) { position.x = 100; });
+    view<actor*, position> view_with_actor(world);
+    view_with_actor.each([](actor* actor, position& position) { position.x = 100; });
     auto elapsed = timer.elapse();
-    std::cout << "Iterating entities with node pointer: " << elapsed << " seconds" << std::endl;
+    std::cout << "Iterating entities with actor pointer: " << elapsed << " seconds" << std::endl;
 
     timer.start();
-    view<position> view_without_node(world);
-    view_without_node.each([](position& position) { position.x = 100; });
+    view<position> view_without_actor(world);
+    view_without_actor.each([](position& position) { position.x = 100; });
     elapsed = timer.elapse();
-    std::cout << "Iterating entities without node pointer: " << elapsed << " seconds" << std::endl;
+    std::cout << "Iterating entities without actor pointer: " << elapsed << " seconds" << std::endl;
 }
 
 TEST_CASE("Access components", "[benchmark]")
 {
     timer timer;
     world world;
+    world.register_component<position>();
 
-    node n1("test_node", &world);
-    n1.add_component<position>();
+    actor a1("test_actor", world);
+    a1.add<position>();
 
-    component_ptr<position> p = n1.get_component<position>();
+    component_ptr<position> p = a1.get<position>();
 
     timer.start();
     for (std::size_t i = 0; i < 1000000; ++i)
@@ -72,7 +74,7 @@ TEST_CASE("Access components", "[benchmark]")
 
     timer.start();
     for (std::size_t i = 0; i < 1000000; ++i)
-        n1.get_component<position>()->x = 100;
+        a1.get<position>()->x = 100;
     elapsed = timer.elapse();
     std::cout << "Do not save component pointer: " << elapsed << " seconds" << std::endl;
 }
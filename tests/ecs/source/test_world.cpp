@@ -1,4 +1,12 @@
 #include "test_common.hpp"
+#include "core/task/task_executor.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
 
 namespace violet::test
 {
@@ -23,24 +31,27 @@ TEST_CASE("world::create", "[world]")
 TEST_CASE("world::add & world::remove", "[world]")
 {
     life_counter<0>::reset();
+    life_counter<1>::reset();
 
     world world;
+    world.register_component<life_counter<0>>();
+    world.register_component<life_counter<1>>();
 
     entity e1 = world.create(nullptr);
     entity e2 = world.create(nullptr);
 
-    world.add<life_counter<0>>(e1);
+    world.add_component<life_counter<0>>(e1);
     CHECK(life_counter<0>::check(1, 0, 0, 0, 0, 0));
     CHECK(e1.index == 0);
 
-    world.add<life_counter<1>>(e1);
+    world.add_component<life_counter<1>>(e1);
     CHECK(life_counter<0>::check(1, 0, 1, 0, 0, 1));
     CHECK(life_counter<1>::check(1, 0, 0, 0, 0, 0));
 
-    world.add<life_counter<0>>(e2);
+    world.add_component<life_counter<0>>(e2);
     CHECK(life_counter<0>::check(2, 0, 1, 0, 0, 1));
 
-    world.remove<life_counter<1>>(e1);
+    world.remove_component<life_counter<1>>(e1);
     CHECK(life_counter<0>::check(2, 0, 2, 0, 0, 2));
     CHECK(life_counter<1>::check(1, 0, 0, 0, 0, 1));
 }
@@ -48,34 +59,38 @@ TEST_CASE("world::add & world::remove", "[world]")
 TEST_CASE("world::add & world::remove 2", "[world]")
 {
     world world;
+    world.register_component<position>();
+    world.register_component<rotation>();
     std::vector<entity> entities;
 
     for (std::size_t i = 0; i < 3; ++i)
     {
         entity e = world.create(nullptr);
-        world.add<position>(e);
+        world.add_component<position>(e);
         entities.push_back(e);
     }
 
     for (std::size_t i = 0; i < 3; ++i)
     {
         if (i % 2 == 0)
-            world.add<rotation>(entities[i]);
+            world.add_component<rotation>(entities[i]);
     }
 }
 
 TEST_CASE("world::component", "[world]")
 {
     world world;
+    world.register_component<position>();
+    world.register_component<int>();
 
     entity e1 = world.create(nullptr);
-    world.add<position>(e1);
+    world.add_component<position>(e1);
 
     position& p1 = world.get_component<position>(e1);
     position* ptr1 = &p1;
     p1 = {1, 2, 3};
 
-    world.add<int>(e1);
+    world.add_component<int>(e1);
     position& p2 = world.get_component<position>(e1);
     position* ptr2 = &p2;
 
@@ -85,15 +100,41 @@ TEST_CASE("world::component", "[world]")
     CHECK(p2.z == 3);
 }
 
+TEST_CASE("world::component with cache", "[world]")
+{
+    world world;
+    world.register_component<position>();
+
+    entity e1 = world.create(nullptr);
+    world.add_component<position>(e1);
+    world.get_component<position>(e1).x = 1;
+
+    world::component_cache cache;
+    CHECK(world.get_component<position>(e1, cache).x == 1);
+    CHECK(world.get_component<const position>(e1, cache).x == 1);
+
+    // The slot of e1 is reused by e2 in the same archetype, the cache must not be trusted.
+    world.release(e1);
+    entity e2 = world.create(nullptr);
+    world.add_component<position>(e2);
+    world.get_component<position>(e2).x = 2;
+    CHECK(e2.index == e1.index);
+    CHECK(e2.entity_version != e1.entity_version);
+
+    CHECK(world.get_component<position>(e2, cache).x == 2);
+    CHECK(cache.entity_version == e2.entity_version);
+}
+
 TEST_CASE("view", "[world]")
 {
     world world;
+    world.register_component<int>();
 
     entity e1 = world.create(nullptr);
     entity e2 = world.create(nullptr);
 
-    world.add<int>(e1);
-    world.add<int>(e2);
+    world.add_component<int>(e1);
+    world.add_component<int>(e2);
 
     world.get_component<int>(e1) = 1;
     world.get_component<int>(e2) = 2;
@@ -104,4 +145,944 @@ TEST_CASE("view", "[world]")
     CHECK(world.get_component<int>(e1) == 11);
     CHECK(world.get_component<int>(e2) == 12);
 }
+
+TEST_CASE("view query cache", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<velocity>();
+    world.register_component<rotation>();
+
+    entity e1 = world.create(nullptr);
+    world.add_component<position>(e1);
+
+    // The views are built before the archetypes of the later entities exist.
+    view<const position> positions(world);
+    view<const position, without<rotation>> without_rotation(world);
+
+    auto count = [](auto& view)
+    {
+        std::size_t result = 0;
+        view.each(
+            [&result](const position&)
+            {
+                ++result;
+            });
+        return result;
+    };
+    CHECK(count(positions) == 1);
+    CHECK(count(without_rotation) == 1);
+
+    entity e2 = world.create(nullptr);
+    world.add_component<position, velocity>(e2);
+    entity e3 = world.create(nullptr);
+    world.add_component<position, rotation>(e3);
+    entity e4 = world.create(nullptr);
+    world.add_component<velocity>(e4);
+
+    CHECK(count(positions) == 3);
+    CHECK(count(without_rotation) == 2);
+
+    // A view built later with the same terms shares the cached list.
+    view<const position> later(world);
+    CHECK(count(later) == 3);
+}
+
+TEST_CASE("view terms", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<velocity>();
+    world.register_component<rotation>();
+
+    // Entity i has a velocity when bit 0 of i is set and a rotation when bit 1 is set.
+    std::vector<entity> entities;
+    for (int i = 0; i < 4; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position>(e);
+        world.get_component<position>(e).x = i;
+        if (i & 1)
+        {
+            world.add_component<velocity>(e);
+            world.get_component<velocity>(e).x = i * 10;
+        }
+        if (i & 2)
+        {
+            world.add_component<rotation>(e);
+            world.get_component<rotation>(e).angle = i * 100;
+        }
+        entities.push_back(e);
+    }
+
+    auto collect = [](auto&& view)
+    {
+        std::set<int> result;
+        view.each(
+            [&result](const position& position, auto&&...)
+            {
+                result.insert(position.x);
+            });
+        return result;
+    };
+
+    CHECK(collect(view<const position, without<velocity>>(world)) == std::set<int>{0, 2});
+    CHECK(collect(view<const position, without<velocity, rotation>>(world)) == std::set<int>{0});
+    CHECK(
+        collect(view<const position, any_of<velocity, rotation>>(world)) ==
+        std::set<int>{1, 2, 3});
+    CHECK(collect(view<const position, any_of<velocity>>(world)) == std::set<int>{1, 3});
+
+    // Optional components are null when the entity does not have them.
+    std::size_t count = 0;
+    view<const position, optional<const velocity, rotation>>(world).each(
+        [&count](const position& position, const velocity* velocity, rotation* rotation)
+        {
+            CHECK((velocity != nullptr) == static_cast<bool>(position.x & 1));
+            CHECK((rotation != nullptr) == static_cast<bool>(position.x & 2));
+            if (velocity != nullptr)
+                CHECK(velocity->x == position.x * 10);
+            if (rotation != nullptr)
+                CHECK(rotation->angle == position.x * 100);
+            ++count;
+        });
+    CHECK(count == 4);
+
+    // Chunk functors get empty spans instead.
+    count = 0;
+    view<const position, optional<const velocity>>(world).each_chunk(
+        [&count](
+            std::size_t size,
+            std::span<const position> positions,
+            std::span<const velocity> velocities)
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                CHECK(velocities.empty() != static_cast<bool>(positions[i].x & 1));
+                if (!velocities.empty())
+                    CHECK(velocities[i].x == positions[i].x * 10);
+            }
+            count += size;
+        });
+    CHECK(count == 4);
+
+    // any_of passes its components the same way as optional.
+    view<const position, any_of<const velocity, const rotation>>(world).each(
+        [](const position& position, const velocity* velocity, const rotation* rotation)
+        {
+            CHECK((velocity != nullptr || rotation != nullptr));
+            CHECK((velocity != nullptr) == static_cast<bool>(position.x & 1));
+        });
+}
+TEST_CASE("view::each_changed", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<velocity>();
+
+    std::vector<entity> entities;
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position, velocity>(e);
+        entities.push_back(e);
+    }
+
+    actor actor("test_actor", world);
+    actor.add<position, velocity>();
+
+    view<const position, velocity> view(world);
+    std::uint32_t version = 0;
+    auto count_changed = [&]()
+    {
+        std::size_t count = 0;
+        view.each_changed<const position>(
+            version,
+            [&count](const position&, velocity&)
+            {
+                ++count;
+            });
+        return count;
+    };
+
+    // Added entities are changed, and nothing is changed after they are visited.
+    CHECK(count_changed() == 1001);
+    CHECK(count_changed() == 0);
+
+    // Reads do not stamp the chunk.
+    CHECK(world.get_component<const position>(entities[10]).x == 0);
+    CHECK(actor.get<position>().read()->x == 0);
+    CHECK(count_changed() == 0);
+
+    // A write only stamps the chunk of the entity.
+    world.get_component<position>(entities[10]).x = 1;
+    std::size_t count = count_changed();
+    CHECK(count > 0);
+    CHECK(count < 1001);
+
+    // The view writes velocity, which is not a filter.
+    CHECK(count_changed() == 0);
+
+    actor.get<position>()->x = 1;
+    CHECK(count_changed() > 0);
+}
+
+TEST_CASE("world::reserve_entity", "[world]")
+{
+    world world;
+
+    std::vector<entity> released;
+    for (std::size_t i = 0; i < 1000; ++i)
+        released.push_back(world.create(nullptr));
+    world.release_batch(released);
+
+    // Reserve across several pages of entity infos while the main thread checks indices that
+    // may not have a page yet.
+    std::vector<std::vector<entity>> reserved(4);
+    std::vector<std::thread> threads;
+    for (auto& entities : reserved)
+    {
+        threads.emplace_back(
+            [&world, &entities]()
+            {
+                for (std::size_t i = 0; i < 5000; ++i)
+                    entities.push_back(world.reserve_entity());
+            });
+    }
+
+    for (std::uint32_t i = 0; i < 20000; ++i)
+        static_cast<void>(world.is_valid(entity{.index = i}));
+
+    for (auto& thread : threads)
+        thread.join();
+
+    std::set<std::uint32_t> indices;
+    for (auto& entities : reserved)
+    {
+        for (entity e : entities)
+        {
+            indices.insert(e.index);
+
+            CHECK(world.is_valid(e).first);
+            world.create(e, nullptr);
+        }
+    }
+    CHECK(indices.size() == 20000);
+
+    std::size_t count = 0;
+    view<actor*>(world).each(
+        [&count](actor*)
+        {
+            ++count;
+        });
+    CHECK(count == 20000);
+}
+
+namespace
+{
+struct name
+{
+    std::string value;
+};
+
+class name_info : public component_info_default<name>
+{
+public:
+    bool serialize(const void* source, std::vector<std::uint8_t>& output) override
+    {
+        const std::string& value = static_cast<const name*>(source)->value;
+
+        auto size = static_cast<std::uint32_t>(value.size());
+        const auto* size_data = reinterpret_cast<const std::uint8_t*>(&size);
+        output.insert(output.end(), size_data, size_data + sizeof(size));
+        output.insert(output.end(), value.begin(), value.end());
+        return true;
+    }
+
+    std::size_t deserialize(std::span<const std::uint8_t> source, void* target) override
+    {
+        std::uint32_t size;
+        if (source.size() < sizeof(size))
+            return 0;
+        std::memcpy(&size, source.data(), sizeof(size));
+
+        if (source.size() - sizeof(size) < size)
+            return 0;
+
+        const auto* value = reinterpret_cast<const char*>(source.data() + sizeof(size));
+        static_cast<name*>(target)->value.assign(value, size);
+        return sizeof(size) + size;
+    }
+};
+} // namespace
+
+TEST_CASE("world::create_batch & world::release_batch", "[world]")
+{
+    // Small chunks, so the batch spans many chunks.
+    world world(1024);
+    world.register_component<position>();
+    world.register_component<velocity>();
+
+    std::vector<actor*> owners(500, nullptr);
+    std::vector<entity> entities = world.create_batch<position, velocity>(owners);
+    REQUIRE(entities.size() == 500);
+
+    std::set<std::uint32_t> indices;
+    for (std::size_t i = 0; i < entities.size(); ++i)
+    {
+        CHECK(world.is_valid(entities[i]) == std::make_pair(true, true));
+        CHECK(world.get_component<const position>(entities[i]).x == 0);
+        world.get_component<position>(entities[i]).x = static_cast<int>(i);
+        indices.insert(entities[i].index);
+    }
+    CHECK(indices.size() == 500);
+
+    // Release a run that crosses chunks and every third entity of the rest.
+    std::vector<entity> released;
+    std::vector<std::size_t> alive;
+    for (std::size_t i = 0; i < entities.size(); ++i)
+    {
+        if ((i >= 100 && i < 250) || i % 3 == 0)
+            released.push_back(entities[i]);
+        else
+            alive.push_back(i);
+    }
+    world.release_batch(released);
+
+    for (const entity& e : released)
+        CHECK_FALSE(world.is_valid(e).first);
+    for (std::size_t i : alive)
+        CHECK(world.get_component<const position>(entities[i]).x == static_cast<int>(i));
+
+    std::size_t count = 0;
+    view<const position, const velocity>(world).each(
+        [&count](const position&, const velocity&)
+        {
+            ++count;
+        });
+    CHECK(count == alive.size());
+    CHECK(
+        world.get_memory_stats().used_bytes ==
+        alive.size() *
+            (sizeof(position) + sizeof(velocity) + sizeof(actor*) + sizeof(entity_record)));
+}
+
+TEST_CASE("world::trim", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.set_chunk_size<position>(4096);
+
+    std::vector<actor*> owners(1000, nullptr);
+    std::vector<entity> entities = world.create_batch<position>(owners);
+
+    world_memory_stats stats = world.get_memory_stats();
+    CHECK(stats.used_bytes == 1000 * (sizeof(position) + sizeof(actor*) + sizeof(entity_record)));
+    CHECK(stats.allocated_bytes != 0);
+    CHECK(stats.allocated_bytes % 4096 == 0);
+    CHECK(stats.reserved_bytes == stats.allocated_bytes);
+
+    // Released chunks stay in the pool.
+    world.release_batch(entities);
+    CHECK(world.get_memory_stats().used_bytes == 0);
+    CHECK(world.get_memory_stats().allocated_bytes == 0);
+    CHECK(world.get_memory_stats().reserved_bytes == stats.allocated_bytes);
+
+    // The chunks were needed since the last trim, they are released by the trim after that.
+    CHECK(world.trim() == 0);
+    CHECK(world.trim() == stats.allocated_bytes);
+    CHECK(world.get_memory_stats().reserved_bytes == 0);
+
+    // A smaller peak keeps only the chunks it needed.
+    entities = world.create_batch<position>(owners);
+    world.release_batch(entities);
+    CHECK(world.trim() == 0);
+    world.create_batch<position>(std::span<actor* const>(owners).first(100));
+    std::size_t released = world.trim();
+    CHECK(released != 0);
+    CHECK(released < stats.allocated_bytes);
+    CHECK(world.get_memory_stats().reserved_bytes == world.get_memory_stats().allocated_bytes);
+}
+
+TEST_CASE("entity_command_buffer", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<velocity>();
+
+    entity moved = world.create(nullptr);
+    world.add_component<position>(moved);
+    entity released = world.create(nullptr);
+    entity shrunk = world.create(nullptr);
+    world.add_component<position, velocity>(shrunk);
+
+    entity_command_buffer& buffer = world.get_command_buffer();
+
+    // Created entities are reserved while recording and can be used by later commands.
+    entity created = buffer.create(nullptr, position{1, 2, 3});
+    CHECK(world.is_valid(created).first);
+    CHECK(created.index != moved.index);
+    buffer.add_component<velocity>(created);
+
+    buffer.add_component(moved, velocity{4, 5, 6});
+    buffer.remove_component<position>(moved);
+    buffer.release(released);
+    buffer.remove_component<velocity>(shrunk);
+
+    // Commands recorded on other threads go to their own buffer.
+    entity other;
+    std::thread thread(
+        [&world, &other]()
+        {
+            entity_command_buffer& other_buffer = world.get_command_buffer();
+            other = other_buffer.create(nullptr, position{7, 8, 9});
+            other_buffer.release(other);
+        });
+    thread.join();
+
+    // Nothing changes until the playback.
+    CHECK_FALSE(world.has_component<velocity>(moved));
+    CHECK(world.is_valid(released).first);
+    CHECK(world.has_component<velocity>(shrunk));
+
+    world.playback();
+    CHECK(buffer.empty());
+
+    CHECK(world.has_component<position>(created));
+    CHECK(world.has_component<velocity>(created));
+    CHECK(world.get_component<const position>(created).y == 2);
+    CHECK(world.get_component<actor*>(created) == nullptr);
+
+    CHECK_FALSE(world.has_component<position>(moved));
+    CHECK(world.get_component<const velocity>(moved).z == 6);
+
+    CHECK_FALSE(world.is_valid(released).first);
+    CHECK_FALSE(world.is_valid(other).first);
+
+    CHECK(world.has_component<position>(shrunk));
+    CHECK_FALSE(world.has_component<velocity>(shrunk));
+
+    std::size_t count = 0;
+    view<const position>(world).each(
+        [&count](const position&)
+        {
+            ++count;
+        });
+    CHECK(count == 2);
+}
+
+TEST_CASE("world::merge", "[world]")
+{
+    constexpr std::size_t entity_size = sizeof(position) + sizeof(actor*) + sizeof(entity_record);
+
+    world main;
+    main.register_component<position>();
+
+    auto create = [](world& world, int first, int count)
+    {
+        std::vector<entity> result;
+        for (int i = first; i < first + count; ++i)
+        {
+            entity e = world.create(nullptr);
+            world.add_component<position>(e);
+            world.get_component<position>(e).x = i;
+            result.push_back(e);
+        }
+        return result;
+    };
+
+    auto count_entities = [](world& world)
+    {
+        std::size_t count = 0;
+        view<const position>(world).each(
+            [&count](const position&)
+            {
+                ++count;
+            });
+        return count;
+    };
+
+    std::vector<entity> main_entities = create(main, 0, 100);
+
+    SECTION("same chunk size")
+    {
+        world background(main.get_component_table());
+        std::vector<entity> entities = create(background, 1000, 1000);
+
+        world_memory_stats main_stats = main.get_memory_stats();
+        world_memory_stats background_stats = background.get_memory_stats();
+
+        std::vector<entity> merged = main.merge(background);
+        CHECK(count_entities(main) == 1100);
+        CHECK(count_entities(background) == 0);
+
+        for (int i = 0; i < 100; ++i)
+            CHECK(main.get_component<const position>(main_entities[i]).x == i);
+        for (int i = 0; i < 1000; ++i)
+        {
+            CHECK_FALSE(background.is_valid(entities[i]).first);
+            CHECK(main.get_component<const position>(merged[entities[i].index]).x == 1000 + i);
+        }
+
+        // The chunks of the background are taken over, only the last chunk of the main world is
+        // filled by copying.
+        world_memory_stats stats = main.get_memory_stats();
+        CHECK(stats.used_bytes == 1100 * entity_size);
+        CHECK(
+            stats.allocated_bytes <=
+            main_stats.allocated_bytes + background_stats.allocated_bytes);
+        CHECK(stats.allocated_bytes >= main_stats.allocated_bytes);
+        CHECK(background.get_memory_stats().used_bytes == 0);
+        CHECK(background.get_memory_stats().allocated_bytes == 0);
+
+        main.release_batch(main_entities);
+        CHECK(main.get_memory_stats().used_bytes == 1000 * entity_size);
+    }
+
+    SECTION("different chunk size")
+    {
+        world background(main.get_component_table());
+        background.set_chunk_size<position>(4096);
+        std::vector<entity> entities = create(background, 1000, 1000);
+        CHECK(background.get_memory_stats().allocated_bytes % 4096 == 0);
+
+        std::vector<entity> merged = main.merge(background);
+        CHECK(count_entities(main) == 1100);
+
+        for (int i = 0; i < 1000; ++i)
+            CHECK(main.get_component<const position>(merged[entities[i].index]).x == 1000 + i);
+
+        // The entities are copied into chunks of the main world, the background keeps its free
+        // chunks until they are trimmed.
+        world_memory_stats stats = main.get_memory_stats();
+        CHECK(stats.used_bytes == 1100 * entity_size);
+        CHECK(stats.allocated_bytes % DEFAULT_CHUNK_SIZE == 0);
+        CHECK(background.get_memory_stats().allocated_bytes == 0);
+        CHECK(background.get_memory_stats().reserved_bytes != 0);
+        CHECK(background.trim() == 0);
+        CHECK(background.trim() != 0);
+        CHECK(background.get_memory_stats().reserved_bytes == 0);
+    }
+}
+
+TEST_CASE("world::merge with non-trivial components", "[world]")
+{
+    struct name
+    {
+        std::string value;
+    };
+
+    life_counter<2>::reset();
+
+    world main;
+    main.register_component<name>();
+    main.register_component<life_counter<2>>();
+
+    // Different chunk sizes, so the entities are moved in bulk column by column.
+    world background(main.get_component_table());
+    background.set_chunk_size<name, life_counter<2>>(1024);
+
+    std::vector<entity> entities;
+    for (int i = 0; i < 100; ++i)
+    {
+        entity e = background.create(nullptr);
+        background.add_component<name, life_counter<2>>(e);
+        background.get_component<name>(e).value = "a name longer than the small buffer " +
+                                                  std::to_string(i);
+        entities.push_back(e);
+    }
+    life_counter<2>::reset();
+
+    std::vector<entity> merged = main.merge(background);
+    for (int i = 0; i < 100; ++i)
+    {
+        CHECK(
+            main.get_component<const name>(merged[entities[i].index]).value ==
+            "a name longer than the small buffer " + std::to_string(i));
+    }
+
+    // Each component is move constructed once and the moved-from component destroyed.
+    CHECK(life_counter<2>::check(0, 0, 100, 0, 0, 100));
+}
+
+TEST_CASE("world::save & world::load", "[world]")
+{
+    world source;
+    source.register_component<position>();
+    source.register_component<rotation>();
+    source.register_component<name, name_info>();
+
+    std::vector<entity> entities;
+    for (int i = 0; i < 100; ++i)
+    {
+        entity e = source.create(nullptr);
+        source.add_component<position>(e);
+        source.get_component<position>(e) = {i, i + 1, i + 2};
+
+        if (i % 2 == 0)
+        {
+            source.add_component<name>(e);
+            source.get_component<name>(e).value = "entity_name_" + std::to_string(i);
+        }
+
+        if (i % 3 == 0)
+        {
+            source.add_component<rotation>(e);
+            source.get_component<rotation>(e).angle = i;
+        }
+
+        entities.push_back(e);
+    }
+
+    std::vector<std::uint8_t> snapshot = source.save();
+
+    // rotation is not registered in the loading world and is skipped.
+    world target;
+    target.register_component<name, name_info>();
+    target.register_component<position>();
+
+    std::vector<entity> mapping = target.load(snapshot);
+    REQUIRE_FALSE(mapping.empty());
+
+    for (int i = 0; i < 100; ++i)
+    {
+        entity e = mapping[entities[i].index];
+        REQUIRE(target.is_valid(e).first);
+
+        CHECK(target.get_component<const position>(e).y == i + 1);
+        CHECK(target.has_component<name>(e) == (i % 2 == 0));
+        if (i % 2 == 0)
+            CHECK(target.get_component<const name>(e).value == "entity_name_" + std::to_string(i));
+    }
+
+    auto count_position = [](world& world)
+    {
+        std::size_t count = 0;
+        view<const position>(world).each(
+            [&count](const position&)
+            {
+                ++count;
+            });
+        return count;
+    };
+    CHECK(count_position(target) == 100);
+
+    // Truncated and corrupt snapshots are rejected without changing the world.
+    for (std::size_t size : {std::size_t(0), snapshot.size() / 2, snapshot.size() - 1})
+    {
+        std::vector<std::uint8_t> truncated(snapshot.begin(), snapshot.begin() + size);
+        CHECK(target.load(truncated).empty());
+    }
+
+    std::vector<std::uint8_t> corrupt = snapshot;
+    corrupt[8] = 0xFF; // component_count
+    CHECK(target.load(corrupt).empty());
+
+    // Point every component of the first archetype at its first component, so that its columns
+    // refer to components the archetype does not have. The header takes 24 bytes, each component
+    // 16 bytes and the archetype header 16 bytes.
+    corrupt = snapshot;
+    std::uint32_t component_count;
+    std::memcpy(&component_count, snapshot.data() + 8, sizeof(component_count));
+    std::size_t archetype_offset = 24 + component_count * 16;
+    std::uint32_t archetype_component_count;
+    std::memcpy(
+        &archetype_component_count,
+        snapshot.data() + archetype_offset,
+        sizeof(archetype_component_count));
+    REQUIRE(archetype_component_count > 1);
+    for (std::uint32_t i = 1; i < archetype_component_count; ++i)
+    {
+        std::memcpy(
+            corrupt.data() + archetype_offset + 16 + i * sizeof(std::uint32_t),
+            snapshot.data() + archetype_offset + 16,
+            sizeof(std::uint32_t));
+    }
+    CHECK(target.load(corrupt).empty());
+
+    CHECK(count_position(target) == 100);
+}
+
+namespace
+{
+struct material
+{
+    int id;
+
+    bool operator==(const material&) const = default;
+};
+} // namespace
+
+TEST_CASE("world::set_shared_component", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_shared_component<material>();
+
+    std::vector<entity> entities;
+    for (int i = 0; i < 100; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position>(e);
+        world.get_component<position>(e).x = i;
+        world.set_shared_component(e, material{i % 4});
+        entities.push_back(e);
+    }
+
+    // Entities with the same value share chunks, so every chunk has a single value.
+    std::map<int, std::size_t> counts;
+    view<const position>(world).each_chunk_shared<material>(
+        [&counts](const material& material, std::size_t count, std::span<const position> positions)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+                CHECK(positions[i].x % 4 == material.id);
+            counts[material.id] += count;
+        });
+    CHECK(counts.size() == 4);
+    for (auto& [id, count] : counts)
+        CHECK(count == 25);
+
+    // Changing the value moves the entity and keeps its components.
+    world.set_shared_component(entities[1], material{7});
+    CHECK(world.get_shared_component<material>(entities[1]).id == 7);
+    CHECK(world.get_shared_component<material>(entities[5]).id == 1);
+    CHECK(world.get_component<const position>(entities[1]).x == 1);
+
+    world.remove_component<material>(entities[2]);
+    CHECK_FALSE(world.has_component<material>(entities[2]));
+    CHECK(world.get_component<const position>(entities[2]).x == 2);
+
+    // Values are released when no chunk uses them.
+    auto& info = static_cast<shared_component_info<material>&>(
+        *(*world.get_component_table())[component_index::value<material>()]);
+    CHECK(info.get_value_count() == 5);
+
+    world.set_shared_component(entities[1], material{1});
+    CHECK(info.get_value_count() == 4);
+
+    world.release_batch(entities);
+    CHECK(info.get_value_count() == 0);
+}
+
+TEST_CASE("world::set_shared_component across chunks", "[world]")
+{
+    world world(256);
+    world.register_component<position>();
+    world.register_shared_component<material>();
+
+    std::vector<entity> entities;
+    std::vector<int> materials;
+    for (int i = 0; i < 300; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position>(e);
+        world.get_component<position>(e).x = i;
+        world.set_shared_component(e, material{i % 5});
+        entities.push_back(e);
+        materials.push_back(i % 5);
+    }
+
+    // Release entities of every value and move others between values, which leaves chunks of the
+    // archetype partially filled and releases chunk slots in the middle.
+    std::vector<entity> released;
+    std::vector<entity> alive;
+    for (int i = 0; i < 300; ++i)
+    {
+        if (i % 3 == 0)
+        {
+            released.push_back(entities[i]);
+        }
+        else
+        {
+            if (i % 7 == 0)
+            {
+                materials[i] = 5;
+                world.set_shared_component(entities[i], material{5});
+            }
+            alive.push_back(entities[i]);
+        }
+    }
+    world.release_batch(released);
+
+    auto check = [&]()
+    {
+        std::map<int, std::size_t> expected;
+        for (int i = 0; i < 300; ++i)
+        {
+            if (i % 3 == 0)
+                continue;
+
+            CHECK(world.get_component<const position>(entities[i]).x == i);
+            CHECK(world.get_shared_component<material>(entities[i]).id == materials[i]);
+            ++expected[materials[i]];
+        }
+
+        std::map<int, std::size_t> counts;
+        view<const position>(world).each_chunk_shared<material>(
+            [&counts](
+                const material& material,
+                std::size_t count,
+                std::span<const position> positions)
+            {
+                CHECK(count != 0);
+                CHECK(positions.size() == count);
+                counts[material.id] += count;
+            });
+        CHECK(counts == expected);
+    };
+    check();
+
+    // Entities are created into the released slots.
+    for (int i = 0; i < 50; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position>(e);
+        world.set_shared_component(e, material{6});
+        world.release(e);
+    }
+    check();
+
+    // Sorting keeps each entity with its value.
+    world.sort<position>(
+        [](const position& position)
+        {
+            return -position.x;
+        });
+    check();
+
+    world_memory_stats stats = world.get_memory_stats();
+    CHECK(stats.used_bytes == 200 * (sizeof(position) + sizeof(actor*) + sizeof(entity_record)));
+
+    world.release_batch(alive);
+    CHECK(world.get_memory_stats().allocated_bytes == 0);
+}
+
+TEST_CASE("world::defragment", "[world]")
+{
+    world world;
+    world.register_component<position>();
+
+    std::vector<entity> entities;
+    for (int i = 0; i < 100; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position>(e);
+        world.get_component<position>(e).x = (i * 37) % 100;
+        entities.push_back(e);
+    }
+
+    std::size_t key_count = 0;
+    auto key = [&key_count](const position& position)
+    {
+        ++key_count;
+        return position.x;
+    };
+
+    auto is_ordered = [&world]()
+    {
+        std::vector<int> keys;
+        view<const position>(world).each(
+            [&keys](const position& position)
+            {
+                keys.push_back(position.x);
+            });
+        return std::is_sorted(keys.begin(), keys.end());
+    };
+
+    // The swaps are spread across calls.
+    std::size_t call_count = 0;
+    while (std::size_t swap_count = world.defragment<position>(key, 10))
+    {
+        CHECK(swap_count <= 10);
+        ++call_count;
+    }
+    CHECK(call_count > 1);
+    CHECK(is_ordered());
+
+    for (int i = 0; i < 100; ++i)
+        CHECK(world.get_component<const position>(entities[i]).x == (i * 37) % 100);
+
+    // Archetypes that are in order and not written are skipped without evaluating keys.
+    key_count = 0;
+    CHECK(world.defragment<position>(key, 10) == 0);
+    CHECK(key_count == 0);
+
+    world.get_component<position>(entities[0]).x = 1000;
+    CHECK_FALSE(is_ordered());
+    std::size_t swap_count = 0;
+    while (std::size_t count = world.defragment<position>(key, 10))
+        swap_count += count;
+    CHECK(swap_count > 0);
+    CHECK(is_ordered());
+    CHECK(world.get_component<const position>(entities[0]).x == 1000);
+}
+
+TEST_CASE("view::parallel_each", "[world]")
+{
+    world world;
+    world.register_component<position>();
+    world.register_component<velocity>();
+
+    std::vector<entity> entities;
+    for (int i = 0; i < 10000; ++i)
+    {
+        entity e = world.create(nullptr);
+        world.add_component<position, velocity>(e);
+        world.get_component<velocity>(e).x = i;
+        entities.push_back(e);
+    }
+
+    task_executor executor;
+    executor.run(4);
+
+    view<position, const velocity> view(world);
+    view.parallel_each(
+        executor,
+        [](position& position, const velocity& velocity)
+        {
+            position.x += velocity.x;
+        });
+
+    for (int i = 0; i < 10000; ++i)
+        CHECK(world.get_component<const position>(entities[i]).x == i);
+
+    // A view writing the components being written does not run while the first view runs.
+    std::atomic<std::size_t> conflict_count = 0;
+    view.parallel_each(
+        executor,
+        [&](position&, const velocity&)
+        {
+            if (conflict_count == 0)
+            {
+                violet::view<position>(world).parallel_each(
+                    executor,
+                    [&conflict_count](position&)
+                    {
+                        ++conflict_count;
+                    });
+            }
+        });
+    CHECK(conflict_count == 0);
+
+    // The access is released when the functor throws. The executor without workers leaves all
+    // chunks to the calling thread.
+    task_executor idle_executor;
+    CHECK_THROWS(view.parallel_each(
+        idle_executor,
+        [](position&, const velocity&)
+        {
+            throw std::runtime_error("test");
+        }));
+
+    std::atomic<std::size_t> count = 0;
+    view.parallel_each(
+        executor,
+        [&count](position&, const velocity&)
+        {
+            ++count;
+        });
+    CHECK(count == 10000);
+
+    executor.stop();
+}
 } // namespace violet::test
\ No newline at end of file
@@ -1,7 +1,36 @@
 #include "core/task/task.hpp"
 #include "core/task/task_executor.hpp"
+#include "core/task/task_profiler.hpp"
 #include "test_common.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
 #include <queue>
+#include <set>
+
+namespace
+{
+std::atomic<std::size_t> allocation_count = 0;
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    if (void* result = std::malloc(size == 0 ? 1 : size))
+        return result;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
 
 namespace violet::test
 {
@@ -30,4 +59,328 @@ TEST_CASE("dependencies between tasks", "[task]")
 
     CHECK(num == 6);
 }
+
+TEST_CASE("many small tasks", "[task]")
+{
+    std::atomic<int> count = 0;
+
+    task_graph<> graph;
+    for (std::size_t i = 0; i < NUM_DATA_PER_THREAD / 10; ++i)
+    {
+        graph.get_root()
+            .then([&count]() { ++count; })
+            .then([&count]() { ++count; })
+            .then([&count]() { ++count; });
+    }
+
+    task_executor executor;
+    executor.run(NUM_THREAD);
+
+    for (std::size_t i = 0; i < 10; ++i)
+        executor.execute_sync(graph);
+
+    executor.stop();
+
+    CHECK(count == NUM_DATA_PER_THREAD * 3);
+}
+
+TEST_CASE("parallel for and reduce", "[task]")
+{
+    std::vector<int> data(NUM_DATA_PER_THREAD * NUM_THREAD);
+
+    std::size_t sum = 0;
+
+    task_graph<> graph;
+    graph.get_root()
+        .then_parallel_for(
+            {0, data.size()},
+            100,
+            [&data](std::size_t index)
+            {
+                data[index] = static_cast<int>(index);
+            })
+        .then_parallel_reduce(
+            {0, data.size()},
+            0,
+            std::size_t(0),
+            [&data](std::size_t index)
+            {
+                return static_cast<std::size_t>(data[index]);
+            },
+            [](std::size_t a, std::size_t b)
+            {
+                return a + b;
+            })
+        .then(
+            [&sum](std::size_t result)
+            {
+                sum = result;
+            });
+
+    task_executor executor;
+    executor.run(NUM_THREAD);
+    executor.execute_sync(graph);
+    executor.stop();
+
+    CHECK(sum == data.size() * (data.size() - 1) / 2);
+}
+
+TEST_CASE("execute again without allocation", "[task]")
+{
+    std::vector<float> data(1000);
+    float sum = 0.0f;
+    int main_thread_count = 0;
+
+    task_graph<float> graph;
+    auto& scale = graph.get_root().then(
+        [](float delta)
+        {
+            return std::make_tuple(delta * 2.0f);
+        });
+    scale
+        .then_parallel_for(
+            {0, data.size()},
+            64,
+            [&data](std::size_t index)
+            {
+                data[index] += 1.0f;
+            })
+        .then_parallel_reduce(
+            {0, data.size()},
+            64,
+            0.0f,
+            [&data](std::size_t index)
+            {
+                return data[index];
+            },
+            [](float a, float b)
+            {
+                return a + b;
+            })
+        .then(
+            [&sum](float result)
+            {
+                sum = result;
+            });
+    scale.then(
+        [&main_thread_count](float scaled_delta)
+        {
+            ++main_thread_count;
+        },
+        TASK_OPTION_MAIN_THREAD);
+
+    task_executor executor;
+    executor.run(NUM_THREAD);
+
+    // The first executions fill the queues and node pools.
+    for (std::size_t i = 0; i < 10; ++i)
+        executor.execute_sync(graph, 0.5f);
+
+    std::size_t count = allocation_count;
+    for (std::size_t i = 0; i < 100; ++i)
+        executor.execute_sync(graph, 0.5f);
+    count = allocation_count - count;
+
+    executor.stop();
+
+    CHECK(count == 0);
+    CHECK(main_thread_count == 110);
+    CHECK(sum == data.size() * 110.0f);
+}
+
+TEST_CASE("priority from the longest path", "[task]")
+{
+    task_graph<> graph;
+    auto& physics = graph.get_root().then([]() {});
+    auto& animation = physics.then([]() {});
+    auto& skinning = animation.then([]() {});
+    auto& audio = graph.get_root().then([]() {});
+
+    graph.reset();
+    CHECK(skinning.get_priority() == 1);
+    CHECK(physics.get_priority() == 3);
+    CHECK(audio.get_priority() == 1);
+    CHECK(graph.get_root().get_priority() == 4);
+
+    audio.set_priority(10);
+    graph.reset();
+    CHECK(audio.get_priority() == 10);
+    CHECK(graph.get_root().get_priority() == 11);
+}
+
+TEST_CASE("main thread takes part in execution", "[task]")
+{
+    std::thread::id main_thread_id = std::this_thread::get_id();
+
+    task_graph<> graph;
+    std::atomic<std::size_t> count = 0;
+    std::thread::id main_task_thread_id;
+    for (std::size_t i = 0; i < 100; ++i)
+    {
+        graph.get_root().then(
+            [&count]()
+            {
+                ++count;
+            });
+    }
+    graph.get_root().then(
+        [&main_task_thread_id]()
+        {
+            main_task_thread_id = std::this_thread::get_id();
+        },
+        TASK_OPTION_MAIN_THREAD);
+
+    // Without workers the calling thread runs every task.
+    task_executor executor;
+    executor.execute_sync(graph);
+    CHECK(count == 100);
+    CHECK(main_task_thread_id == main_thread_id);
+
+    executor.run(NUM_THREAD);
+    for (std::size_t i = 0; i < 10; ++i)
+        executor.execute_sync(graph);
+    executor.stop();
+
+    CHECK(count == 1100);
+    CHECK(main_task_thread_id == main_thread_id);
+}
+
+async_task<int> add_one(task_executor& executor, int value)
+{
+    co_await executor.switch_to(TASK_OPTION_NONE);
+    co_return value + 1;
+}
+
+async_task<int> add_two(task_executor& executor, int value)
+{
+    int result = co_await add_one(executor, value);
+    co_await executor.delay(std::chrono::milliseconds(1));
+    co_return co_await add_one(executor, result);
+}
+
+async_task<std::size_t> read_size(task_executor& executor, std::string path)
+{
+    std::vector<std::uint8_t> data;
+    if (!co_await executor.read_file(path, data))
+        co_return 0;
+    co_return data.size();
+}
+
+async_task<std::thread::id> wait_frame(task_executor& executor)
+{
+    co_await executor.next_frame(TASK_OPTION_MAIN_THREAD);
+    co_return std::this_thread::get_id();
+}
+
+TEST_CASE("async tasks", "[task]")
+{
+    task_executor executor;
+    executor.run(NUM_THREAD);
+
+    async_task<int> add = add_two(executor, 1);
+    executor.schedule(add);
+    CHECK(add.get() == 3);
+
+    std::string path = (std::filesystem::temp_directory_path() / "violet_test_task.bin").string();
+    {
+        std::ofstream fout(path, std::ios::binary);
+        fout << "violet";
+    }
+    async_task<std::size_t> read = read_size(executor, path);
+    executor.schedule(read);
+    CHECK(read.get() == 6);
+    std::filesystem::remove(path);
+
+    async_task<std::thread::id> frame = wait_frame(executor);
+    executor.schedule(frame);
+    while (!frame.is_done())
+        executor.begin_frame();
+    CHECK(frame.get() == std::this_thread::get_id());
+
+    executor.stop();
+}
+
+TEST_CASE("background pool", "[task]")
+{
+    std::mutex lock;
+    std::set<std::thread::id> frame_threads;
+    std::set<std::thread::id> background_threads;
+
+    task_graph<> graph;
+    for (std::size_t i = 0; i < 50; ++i)
+    {
+        graph.get_root().then(
+            [&]()
+            {
+                std::lock_guard<std::mutex> lg(lock);
+                frame_threads.insert(std::this_thread::get_id());
+            });
+        graph.get_root().then(
+            [&]()
+            {
+                std::lock_guard<std::mutex> lg(lock);
+                background_threads.insert(std::this_thread::get_id());
+            },
+            TASK_OPTION_BACKGROUND);
+    }
+
+    task_executor executor;
+    executor.run({{"frame", NUM_THREAD}, {"background", 1}});
+    for (std::size_t i = 0; i < 10; ++i)
+        executor.execute_sync(graph);
+    executor.stop();
+
+    // Background tasks only run on the background worker, which never runs frame tasks.
+    CHECK(background_threads.size() == 1);
+    CHECK(frame_threads.count(*background_threads.begin()) == 0);
+}
+
+TEST_CASE("destroy a graph after waiting for it", "[task]")
+{
+    task_executor executor;
+    executor.run(NUM_THREAD);
+
+    // The graph is destroyed as soon as the wait returns, while the worker that completed the last
+    // task may still be finishing it.
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        std::atomic<int> count = 0;
+
+        task_graph<> graph;
+        for (std::size_t j = 0; j < 4; ++j)
+            graph.get_root().then([&count]() { ++count; });
+
+        if (i % 2 == 0)
+            executor.execute_sync(graph);
+        else
+            executor.execute(graph).wait();
+
+        CHECK(count == 4);
+    }
+
+    executor.stop();
+}
+
+#ifdef VIOLET_TASK_PROFILER
+TEST_CASE("profile tasks", "[task]")
+{
+    task_graph<> graph;
+    auto& first = graph.get_root().then([]() {});
+    first.set_name("first");
+    auto& second = first.then([]() {});
+    second.set_name("second");
+
+    task_executor executor;
+    executor.run(NUM_THREAD);
+
+    task_profiler::get().begin_frame();
+    executor.execute_sync(graph);
+
+    executor.stop();
+
+    std::string trace = task_profiler::get().dump(1);
+    CHECK(trace.find("\"first\"") != std::string::npos);
+    CHECK(trace.find("\"second\"") != std::string::npos);
+}
+#endif
 } // namespace violet::test
\ No newline at end of file